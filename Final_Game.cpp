@@ -3,370 +3,7646 @@
 #include<vector>
 #include<fstream>                          
 #include<limits>                           
+#include<map>
+#include<deque>
+#include<algorithm>
+#include<new>
+#include<type_traits>
+#include<atomic>
+#include<mutex>
+#include<functional>
+#include<thread>
+#include<condition_variable>
+#ifdef __SSE2__
+#include<emmintrin.h>              // SSE2 for the puzzle parser
+#endif
 #include<chrono>                  //Header in C++ is part of the Standard Library and provides facilities for manipulating date and time
+#include<cstring>
+#include<cstdint>
+#include<cstdlib>
+#include<cctype>
+#include<cstdio>
 #include "ScrollEffect.h"         //Include user defined header     
 
+#ifdef __linux__                  // Server mode uses epoll, only available on Linux
+#include<sys/epoll.h>
+#include<sys/socket.h>
+#include<sys/un.h>
+#include<netinet/in.h>
+#include<netinet/tcp.h>
+#include<unistd.h>
+#include<fcntl.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
+#include<sys/syscall.h>
+#include<sys/resource.h>
+#include<linux/io_uring.h>
+#include<linux/futex.h>
+#include<csignal>
+#include<cerrno>
+#endif
+
 using namespace std;
 using namespace std::chrono;
 
-// -------------------- SUDOKU CLASS ---------------------
-class Sudoku
+// -------------------- ALLOCATION COUNTING --------------
+// Global operator new/delete count calls and bytes per thread, so --check-alloc can prove
+// the move and solve paths never allocate. A thread_local increment is all it adds.
+thread_local long long heapAllocations = 0;
+thread_local long long heapBytes = 0;
+
+void* operator new(size_t size)
+{
+    ++heapAllocations;
+    heapBytes += size;
+    void* p = malloc(size ? size : 1);
+    if (p == nullptr)
+        throw bad_alloc();
+    return p;
+}
+void* operator new[](size_t size) { return operator new(size); }
+__attribute__((noinline)) void operator delete(void* p) noexcept { free(p); }      // noinline stops a false GCC new/free mismatch warning
+void operator delete[](void* p) noexcept { operator delete(p); }
+void operator delete(void* p, size_t) noexcept { operator delete(p); }
+void operator delete[](void* p, size_t) noexcept { operator delete(p); }
+
+// -------------------- MEMORY POOLS ---------------------
+// Games are created and deleted at a high rate by the server, so they come from a
+// per-thread free list of fixed 256 byte blocks carved out of 64-block slabs.
+// Solvers take their search stacks from a per-thread arena, marked and rewound in O(1) around each
+// search so that one search can run others (the Samurai corner grids) inside it.
+// Slabs and arena chunks are kept for the life of the thread, so the steady state never calls malloc.
+const size_t GAME_BLOCK_BYTES = 256;
+
+class GamePool
+{
+    struct FreeBlock { FreeBlock* next; };
+    FreeBlock* freeList;
+public:
+    long long slabMallocs;                                   // Calls to malloc made by the pool
+    long long allocations;
+    long long frees;
+
+    GamePool() : freeList(nullptr), slabMallocs(0), allocations(0), frees(0) {};
+
+    void* allocate(size_t size)
+    {
+        if (size > GAME_BLOCK_BYTES)
+            throw bad_alloc();
+        if (freeList == nullptr)
+        {
+            const int blocksPerSlab = 64;
+            char* slab = (char*)malloc(GAME_BLOCK_BYTES * blocksPerSlab);
+            if (slab == nullptr)
+                throw bad_alloc();
+            ++slabMallocs;
+            for (int i = blocksPerSlab - 1; i >= 0; --i)
+            {
+                FreeBlock* block = (FreeBlock*)(slab + i * GAME_BLOCK_BYTES);
+                block->next = freeList;
+                freeList = block;
+            }
+        }
+        FreeBlock* block = freeList;
+        freeList = block->next;
+        ++allocations;
+        return block;
+    }
+
+    void release(void* p)                                    // Goes to this thread's list, even if another thread allocated it
+    {
+        if (p == nullptr)
+            return;
+        FreeBlock* block = (FreeBlock*)p;
+        block->next = freeList;
+        freeList = block;
+        ++frees;
+    }
+};
+
+thread_local GamePool gamePool;
+
+class SearchArena
+{
+    vector<char*> chunks;
+    size_t chunkIndex;                                       // Chunk currently handing out memory
+    size_t used;                                             // Bytes used in that chunk
+public:
+    static const size_t CHUNK_BYTES = 64 * 1024;
+    long long chunkMallocs;
+    long long resets;
+
+    SearchArena() : chunkIndex(0), used(0), chunkMallocs(0), resets(0) {};
+    ~SearchArena() { for (char* chunk : chunks) free(chunk); }
+
+    void* allocate(size_t bytes)
+    {
+        bytes = (bytes + 15) & ~(size_t)15;                  // Keep every allocation 16 byte aligned
+        if (bytes > CHUNK_BYTES)
+            throw bad_alloc();
+        if (chunks.empty() || used + bytes > CHUNK_BYTES)
+        {
+            if (!chunks.empty())
+                ++chunkIndex;
+            if (chunkIndex == chunks.size())
+            {
+                char* chunk = (char*)malloc(CHUNK_BYTES);
+                if (chunk == nullptr)
+                    throw bad_alloc();
+                chunks.push_back(chunk);
+                ++chunkMallocs;
+            }
+            used = 0;
+        }
+        void* p = chunks[chunkIndex] + used;
+        used += bytes;
+        return p;
+    }
+
+    template <typename T>
+    T* allocateArray(size_t count) { return (T*)allocate(sizeof(T) * count); }
+
+    struct Mark { size_t chunkIndex, used; };
+    Mark mark() const { return {chunkIndex, used}; }
+    void rewind(const Mark& m)                               // Forget what was allocated since mark()
+    {
+        chunkIndex = m.chunkIndex;
+        used = m.used;
+        ++resets;
+    }
+
+    void reset()                                             // Forget everything, keep the chunks
+    {
+        chunkIndex = 0;
+        used = 0;
+        ++resets;
+    }
+};
+
+thread_local SearchArena searchArena;
+
+// -------------------- VARIANTS -------------------------
+// A variant is the list of units on its grid: groups of 9 cells that must each hold 1-9 once.
+// Classic has 27 (rows, columns, boxes), diagonal adds the two long diagonals, windoku the
+// four extra 3x3 windows, and jigsaw replaces the boxes by 9 irregular regions. Killer adds
+// cages: cells whose distinct digits must add up to the cage sum. Games and the solver only
+// ever look at the tables built here, so every variant checks and solves through the same code
+// as classic Sudoku.
+// Pack files declare their variant on a line of its own that applies to the puzzles after it:
+//   #variant diagonal windoku
+//   #variant jigsaw 111222333111222333...   (region 1-9 of each of the 81 cells)
+//   #variant killer AABCC.D... 3,15,9,...   (cage of each cell, '.' for none; sums in order of first cell)
+const int MAX_UNITS = 33;                                    // 27 + 2 diagonals + 4 windows
+const int MAX_CELL_UNITS = 6;
+const int MAX_CAGES = 62;
+const int MAX_SUM_GROUPS = MAX_CAGES + MAX_UNITS;            // Cages plus one derived group per unit
+const int MAX_CELL_SUM_GROUPS = 1 + MAX_CELL_UNITS;
+const char CAGE_LETTERS[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789";
+
+struct Variant
+{
+    static const int CELLS = 81, UNITS = MAX_UNITS, SEARCH_CELLS = 81;   // For searchBoard, see SamuraiLayout
+    char name[32];
+    int unitCount;
+    unsigned char units[MAX_UNITS][9];                       // Cells of each unit: rows, columns, regions, extras
+    unsigned char region[81];                                // Box or jigsaw region of each cell, 0-8
+    unsigned char cellUnitCount[81];
+    unsigned char cellUnits[81][MAX_CELL_UNITS];             // Units each cell belongs to
+    uint64_t peers[81][2];                                   // Bit q set - cell q shares a unit with this cell
+    int cageCount;                                           // Cages as declared, numbered from 1
+    int sumGroupCount;                                       // ...followed by the groups derived for the solver
+    unsigned char cageOf[81];                                // Cage of each cell, 0 - not in a cage
+    unsigned char cageSize[MAX_SUM_GROUPS + 1];
+    unsigned char cageSum[MAX_SUM_GROUPS + 1];
+    unsigned char cageCells[MAX_SUM_GROUPS + 1][9];
+    unsigned char cellSumGroupCount[81];
+    unsigned char cellSumGroups[81][MAX_CELL_SUM_GROUPS];    // Cage and derived groups of each cell
+};
+
+struct CageCombinations                                      // Every set of distinct digits, grouped by size and sum
+{
+    uint16_t masks[512];                                     // Bit n set - digit n in the set
+    uint16_t first[10][47];                                  // Sets of size k and sum s: masks[first[k][s] .. first[k][s + 1])
+};
+
+const CageCombinations& cageCombinations()
+{
+    static const CageCombinations table = []
+    {
+        CageCombinations t = {};
+        int count[10][46] = {};
+        for (int set = 0; set < 512; ++set)
+        {
+            int sum = 0;
+            for (int d = 1; d <= 9; ++d)
+                sum += ((set >> (d - 1)) & 1) * d;
+            ++count[__builtin_popcount(set)][sum];
+        }
+        int next = 0, fill[10][46];
+        for (int k = 0; k <= 9; ++k)
+        {
+            for (int sum = 0; sum <= 45; ++sum)
+            {
+                t.first[k][sum] = fill[k][sum] = next;
+                next += count[k][sum];
+            }
+            t.first[k][46] = next;
+        }
+        for (int set = 0; set < 512; ++set)
+        {
+            int sum = 0;
+            for (int d = 1; d <= 9; ++d)
+                sum += ((set >> (d - 1)) & 1) * d;
+            t.masks[fill[__builtin_popcount(set)][sum]++] = (uint16_t)(set << 1);
+        }
+        return t;
+    }();
+    return table;
+}
+
+inline uint16_t cageCandidates(int cellsLeft, int sumLeft, uint16_t placed)   // Digits that can still go in a cage
+{                                                                            // 0 - the cage cannot be completed
+    if (sumLeft < 0 || sumLeft > 45)
+        return 0;
+    const CageCombinations& table = cageCombinations();
+    uint16_t allowed = 0;
+    for (int i = table.first[cellsLeft][sumLeft]; i < table.first[cellsLeft][sumLeft + 1]; ++i)
+        if ((table.masks[i] & placed) == 0)
+            allowed |= table.masks[i];
+    return (cellsLeft == 0 && sumLeft == 0) ? 0x3FE : allowed;   // A complete cage blocks nothing
+}
+
+uint16_t cageCandidatesAt(const Variant& v, const unsigned char* cells, int p)   // Cage digits allowed at p given the
+{                                                                                // other cells of its cage
+    int cage = v.cageOf[p];
+    if (cage == 0)
+        return 0x3FE;
+    uint16_t placed = 0;
+    int left = 0, sum = v.cageSum[cage];
+    for (int i = 0; i < v.cageSize[cage]; ++i)
+    {
+        int q = v.cageCells[cage][i];
+        if (q == p || cells[q] == 0)
+            ++left;
+        else if ((placed >> cells[q]) & 1)
+            return 0;                                        // Digit repeated in the cage
+        else
+        {
+            placed |= 1 << cells[q];
+            sum -= cells[q];
+        }
+    }
+    return cageCandidates(left, sum, placed);
+}
+
+bool buildVariant(Variant& v, const unsigned char* regions, bool diagonal, bool windoku)   // regions - nullptr for 3x3 boxes
+{                                                                                          // false - a region is not 9 cells
+    v = Variant();
+    int regionSize[9] = {};
+    for (int p = 0; p < 81; ++p)
+    {
+        int r = p / 9, c = p % 9;
+        int region = (regions != nullptr) ? regions[p] : r / 3 * 3 + c / 3;
+        if (region > 8 || regionSize[region] == 9)
+            return false;
+        v.region[p] = (unsigned char)region;
+        v.units[r][c] = v.units[9 + c][r] = (unsigned char)p;
+        v.units[18 + region][regionSize[region]++] = (unsigned char)p;
+    }
+    v.unitCount = 27;
+    if (diagonal)
+    {
+        for (int i = 0; i < 9; ++i)
+        {
+            v.units[27][i] = (unsigned char)(i * 9 + i);
+            v.units[28][i] = (unsigned char)(i * 9 + 8 - i);
+        }
+        v.unitCount = 29;
+    }
+    if (windoku)
+    {
+        for (int w = 0; w < 4; ++w)                          // Windows start at rows/columns 1 and 5
+            for (int i = 0; i < 9; ++i)
+                v.units[v.unitCount + w][i] = (unsigned char)((1 + w / 2 * 4 + i / 3) * 9 + 1 + w % 2 * 4 + i % 3);
+        v.unitCount += 4;
+    }
+
+    for (int u = 0; u < v.unitCount; ++u)
+        for (int i = 0; i < 9; ++i)
+        {
+            int p = v.units[u][i];
+            v.cellUnits[p][v.cellUnitCount[p]++] = (unsigned char)u;
+            for (int k = 0; k < 9; ++k)
+                if (v.units[u][k] != p)
+                    v.peers[p][v.units[u][k] >> 6] |= 1ULL << (v.units[u][k] & 63);
+        }
+    snprintf(v.name, sizeof(v.name), "%s%s%s", regions != nullptr ? "jigsaw" : "classic",
+             diagonal ? " diagonal" : "", windoku ? " windoku" : "");
+    return true;
+}
+
+bool addCages(Variant& v, const unsigned char* cageOf, const unsigned char* sums, int count)   // cageOf - 1-based, 0 for none
+{                                                                                              // false - empty or impossible cage
+    if (count > MAX_CAGES)
+        return false;
+    v.cageCount = count;
+    memset(v.cageSize, 0, sizeof(v.cageSize));
+    for (int p = 0; p < 81; ++p)
+    {
+        int cage = cageOf[p];
+        if (cage > count || (cage != 0 && v.cageSize[cage] == 9))
+            return false;
+        v.cageOf[p] = (unsigned char)cage;
+        if (cage != 0)
+            v.cageCells[cage][v.cageSize[cage]++] = (unsigned char)p;
+    }
+    for (int c = 1; c <= count; ++c)
+    {
+        v.cageSum[c] = sums[c - 1];
+        if (v.cageSize[c] == 0 || cageCandidates(v.cageSize[c], v.cageSum[c], 0) == 0)
+            return false;
+    }
+
+    v.sumGroupCount = count;                                 // Rule of 45: the cells of a unit outside the cages that lie
+    for (int u = 0; u < v.unitCount; ++u)                    // wholly inside it hold distinct digits adding up to the rest
+    {
+        int inUnit[MAX_CAGES + 1] = {};
+        for (int i = 0; i < 9; ++i)
+            ++inUnit[v.cageOf[v.units[u][i]]];
+        int g = v.sumGroupCount + 1, rest = 45;
+        v.cageSize[g] = 0;
+        for (int i = 0; i < 9; ++i)
+        {
+            int p = v.units[u][i], cage = v.cageOf[p];
+            if (cage != 0 && inUnit[cage] == v.cageSize[cage])
+                rest -= (v.cageCells[cage][0] == p) ? v.cageSum[cage] : 0;   // Count each inner cage once
+            else
+                v.cageCells[g][v.cageSize[g]++] = (unsigned char)p;
+        }
+        if (v.cageSize[g] == 0 && rest != 0)
+            return false;
+        if (v.cageSize[g] == 0 || v.cageSize[g] == 9)        // Nothing learned
+            continue;
+        if (cageCandidates(v.cageSize[g], rest, 0) == 0)
+            return false;
+        v.cageSum[g] = (unsigned char)rest;
+        v.sumGroupCount = g;
+    }
+    for (int g = 1; g <= v.sumGroupCount; ++g)
+        for (int i = 0; i < v.cageSize[g]; ++i)
+        {
+            int p = v.cageCells[g][i];
+            v.cellSumGroups[p][v.cellSumGroupCount[p]++] = (unsigned char)g;
+        }
+    size_t len = strlen(v.name);
+    snprintf(v.name + len, sizeof(v.name) - len, " killer");
+    return true;
+}
+
+const Variant& classicVariant()
+{
+    static const Variant classic = [] { Variant v; buildVariant(v, nullptr, false, false); return v; }();
+    return classic;
+}
+
+bool parseVariant(const string& spec, Variant& v, string& error)   // Words after "#variant"
+{
+    bool diagonal = false, windoku = false, jigsaw = false;
+    unsigned char regions[81], cages[81] = {}, sums[MAX_CAGES];
+    int cageCount = -1;
+    size_t pos = 0;
+    while (pos < spec.size())
+    {
+        size_t end = spec.find_first_of(" \t\r", pos);
+        if (end == string::npos)
+            end = spec.size();
+        string word = spec.substr(pos, end - pos);
+        pos = end + 1;
+        if (word.empty() || word == "classic")
+            continue;
+        if (word == "diagonal" || word == "x")
+            diagonal = true;
+        else if (word == "windoku" || word == "hyper")
+            windoku = true;
+        else if (word == "jigsaw")
+        {
+            string layout = spec.substr(min(pos, spec.size()), 81);
+            for (int p = 0; p < 81; ++p)
+            {
+                if (p >= (int)layout.size() || layout[p] < '1' || layout[p] > '9')
+                {
+                    error = "jigsaw needs 81 region digits 1-9";
+                    return false;
+                }
+                regions[p] = (unsigned char)(layout[p] - '1');
+            }
+            jigsaw = true;
+            pos += 82;
+        }
+        else if (word == "killer")
+        {
+            string layout = spec.substr(min(pos, spec.size()), 81);
+            string letters;                                  // Cage names in order of their first cell
+            for (char c : layout)
+                if (c != '.' && letters.find(c) == string::npos)
+                    letters += c;
+            if (layout.size() < 81 || layout.find_first_of(" \t") != string::npos || letters.size() > (size_t)MAX_CAGES)
+            {
+                error = "killer needs 81 cage letters ('.' for none), at most " + to_string(MAX_CAGES) + " cages";
+                return false;
+            }
+            for (int p = 0; p < 81; ++p)
+                cages[p] = (unsigned char)(layout[p] == '.' ? 0 : letters.find(layout[p]) + 1);
+
+            size_t listAt = min(spec.find_first_not_of(" \t", pos + 81), spec.size());
+            size_t listEnd = min(spec.find_first_of(" \t\r", listAt), spec.size());
+            string list = spec.substr(listAt, listEnd - listAt);         // "3,15,9,..."
+            cageCount = 0;
+            for (size_t at = 0; at < list.size() && cageCount < MAX_CAGES; )
+            {
+                int sum = atoi(list.c_str() + at);
+                if (sum < 1 || sum > 45)
+                {
+                    error = "cage sums must be 1-45";
+                    return false;
+                }
+                sums[cageCount++] = (unsigned char)sum;
+                size_t comma = list.find(',', at);
+                at = (comma == string::npos) ? list.size() : comma + 1;
+            }
+            if (cageCount != (int)letters.size())
+            {
+                error = to_string(letters.size()) + " cages but " + to_string(cageCount) + " sums";
+                return false;
+            }
+            pos = listEnd + 1;
+        }
+        else
+        {
+            error = "unknown variant '" + word + "'";
+            return false;
+        }
+    }
+    if (!buildVariant(v, jigsaw ? regions : nullptr, diagonal, windoku))
+    {
+        error = "every jigsaw region needs exactly 9 cells";
+        return false;
+    }
+    if (cageCount >= 0 && !addCages(v, cages, sums, cageCount))
+    {
+        error = "a cage has more than 9 cells or a sum its cells cannot reach";
+        return false;
+    }
+    return true;
+}
+
+// -------------------- GRID TRANSFORMS ------------------
+// The symmetries of classic Sudoku, which keep a valid grid valid and a puzzle's difficulty
+// unchanged: relabelling the digits, reordering rows within a band, reordering the bands, the
+// same for columns and stacks, and transposing. GridTransform numbers all of them, so a level
+// beyond the shipped 10 is just (shipped puzzle, transform index) and its board is derived on
+// demand in a few dozen nanoseconds - nothing is stored, and a level id always gives the same board:
+//   level id = variation * 10 + shipped level (1-10), variation 0 being the shipped puzzle itself
+// Variations are spread over the transform indices by a fixed bijection, so neighbouring ids
+// look unrelated. Other variants only keep their rules under digit relabelling, so their
+// variations relabel digits only. Killer cage sums pin the digits, so killer levels have no variations.
+// Rng (xoshiro256**) is the random source for everything seeded in the game.
+class Rng
+{
+    uint64_t s[4];
+
+    static uint64_t rotl(uint64_t x, int k) { return (x << k) | (x >> (64 - k)); }
+public:
+    explicit Rng(uint64_t seed = 0)
+    {
+        for (uint64_t& word : s)                             // splitmix64, so nearby seeds give unrelated states
+        {
+            seed += 0x9E3779B97F4A7C15ULL;
+            uint64_t z = seed;
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+            word = z ^ (z >> 31);
+        }
+    }
+
+    uint64_t next()
+    {
+        uint64_t result = rotl(s[1] * 5, 7) * 9;
+        uint64_t t = s[1] << 17;
+        s[2] ^= s[0];
+        s[3] ^= s[1];
+        s[1] ^= s[2];
+        s[0] ^= s[3];
+        s[2] ^= t;
+        s[3] = rotl(s[3], 45);
+        return result;
+    }
+
+    uint32_t below(uint32_t n) { return (uint32_t)(((next() >> 32) * n) >> 32); }   // 0 to n-1, no division
+
+    void jump()                                              // Same as 2^128 calls to next()
+    {
+        static const uint64_t JUMP[] = {0x180EC6D33CFD0ABAULL, 0xD5A61266F0C9392CULL, 0xA9582618E03FC9AAULL, 0x39ABDC4529B1661CULL};
+        uint64_t t[4] = {};
+        for (uint64_t bits : JUMP)
+            for (int b = 0; b < 64; ++b)
+            {
+                if ((bits >> b) & 1)
+                    for (int i = 0; i < 4; ++i)
+                        t[i] ^= s[i];
+                next();
+            }
+        memcpy(s, t, sizeof(s));
+    }
+
+    static Rng stream(uint64_t seed, int index)              // Sequence index of this seed, one per thread
+    {
+        Rng rng(seed);
+        for (int i = 0; i < index; ++i)
+            rng.jump();
+        return rng;
+    }
+};
+
+const unsigned char PERMUTATIONS_OF_3[6][3] = {{0, 1, 2}, {0, 2, 1}, {1, 0, 2}, {1, 2, 0}, {2, 0, 1}, {2, 1, 0}};
+
+struct GridTransform                                         // A symmetry of classic Sudoku: valid grids stay valid
+{
+    unsigned char digit[10];                                 // New digit for each digit, digit[0] = 0 keeps blanks blank
+    unsigned char rowFrom[9];                                // Input row that becomes each row
+    unsigned char colFrom[9];
+    bool transpose;                                          // Then rows become columns
+
+    static const uint64_t COUNT = 362880ULL * 1679616 * 2;  // 9! digit orders * 6^8 line orders * transposed or not
+
+    static GridTransform fromIndex(uint64_t index)           // A different transform for every index below COUNT, 0 is the identity
+    {
+        GridTransform t;
+        t.transpose = index % 2 != 0;
+        index /= 2;
+        for (unsigned char* from : {t.rowFrom, t.colFrom})
+        {
+            const unsigned char* bands = PERMUTATIONS_OF_3[index % 6];
+            index /= 6;
+            for (int b = 0; b < 3; ++b)
+            {
+                const unsigned char* lines = PERMUTATIONS_OF_3[index % 6];
+                index /= 6;
+                for (int i = 0; i < 3; ++i)
+                    from[b * 3 + i] = (unsigned char)(bands[b] * 3 + lines[i]);
+            }
+        }
+        uint32_t order = (uint32_t)index;                    // Below 9!: the digit order, as an inside-out shuffle
+        t.digit[0] = 0;
+#pragma GCC unroll 9
+        for (uint32_t d = 1; d <= 9; ++d)                    // Unrolled, every division is by a constant
+        {
+            uint32_t j = d - order % d;
+            order /= d;
+            t.digit[d] = t.digit[j];
+            t.digit[j] = (unsigned char)d;
+        }
+        return t;
+    }
+
+    static GridTransform random(Rng& rng)                    // Every transform equally likely
+    {
+        return fromIndex((uint64_t)(((unsigned __int128)rng.next() * COUNT) >> 64));
+    }
+
+    void apply(const unsigned char* in, unsigned char* out) const   // in and out must not overlap
+    {
+        int rowStep = transpose ? 1 : 9, colStep = transpose ? 9 : 1;
+        for (int r = 0; r < 9; ++r)
+        {
+            const unsigned char* row = in + rowFrom[r] * 9;
+            unsigned char* to = out + r * rowStep;
+            for (int c = 0; c < 9; ++c)
+                to[c * colStep] = digit[row[colFrom[c]]];
+        }
+    }
+};
+
+const long long SHIPPED_LEVELS = 10;
+const long long MAX_LEVEL = SHIPPED_LEVELS * (long long)GridTransform::COUNT;   // About 1.2e13 levels per difficulty
+
+int baseLevel(long long level) { return (int)((level - 1) % SHIPPED_LEVELS) + 1; }          // Shipped level 1-10 it derives from
+uint64_t levelVariation(long long level) { return (uint64_t)((level - 1) / SHIPPED_LEVELS); }
+
+const long long GENERATED_LEVELS = 1LL << 48;               // Ids above this are generated puzzles, see PUZZLE POOL:
+const long long GENERATED_SEEDS = 1LL << 47;                //   level id = GENERATED_LEVELS + seed (1 to GENERATED_SEEDS)
+
+bool isGeneratedLevel(long long level) { return level > GENERATED_LEVELS && level <= GENERATED_LEVELS + GENERATED_SEEDS; }
+
+GridTransform levelTransform(long long level, const Variant& rules)
+{
+    const uint64_t SPREAD = 2654435761ULL;                   // Prime, so multiplying by it modulo COUNT is a bijection
+    uint64_t variation = levelVariation(level) % GridTransform::COUNT;
+    uint64_t index = ((variation * (SPREAD >> 16)) % GridTransform::COUNT << 16) + variation * (SPREAD & 0xFFFF);   // No 128-bit product
+    index %= GridTransform::COUNT;
+    if (rules.cageCount > 0)
+        index = 0;
+    GridTransform t = GridTransform::fromIndex(index);
+    if (strcmp(rules.name, "classic") != 0)                  // Keep the cells where they are, relabel only
+    {
+        for (int i = 0; i < 9; ++i)
+            t.rowFrom[i] = t.colFrom[i] = (unsigned char)i;
+        t.transpose = false;
+    }
+    return t;
+}
+
+// -------------------- SUDOKU CLASS ---------------------
+// One game fits in a single block with no heap allocations of its own:
+// 81 cells of one byte, a clue bitmap, one digit mask per unit of its variant (bit n set =
+// digit n used), pointers to the shared puzzle and variant, and a one-step undo journal.
+// Pencil marks, once a player turns them on, take a second block from the same pool; each
+// move and undo updates them for the moved cell's 20 peers only.
+// The first fork ("try this branch") adds a MoveTree: from then on every move is a node of a
+// few bytes, undo goes back any number of moves, and switching branches replays only the moves
+// between the two boards.
+enum Difficulty { EASY, MEDIUM, HARD };
+const char* const DIFFICULTY_NAMES[] = {"easy", "medium", "hard"};
+
+const unsigned char NO_UNDO = 0xFF;
+
+struct PuzzleCatalog                                         // All 10 levels of one difficulty, loaded once
+{
+    unsigned char puzzles[10][81];
+    Variant variants[10];                                    // Killer levels each have their own cages
+};
+
+PuzzleCatalog loadPuzzleFile(const char* path)               // Loads 10 puzzles from file
+{
+    PuzzleCatalog catalog = {};
+    Variant variant = classicVariant();
+    ifstream file(path);
+    for (int p = 0; p < 10; ++p)
+    {
+        string header, error;
+        while ((file >> ws).peek() == '#' && getline(file, header))            // A #variant line applies from here on
+            if (header.compare(0, 8, "#variant") == 0 && !parseVariant(header.substr(8), variant, error))
+            {
+                cout << path << ": " << error << ", playing it as classic Sudoku\n";
+                variant = classicVariant();
+            }
+        catalog.variants[p] = variant;
+        for (int c = 0; c < 81; ++c)
+        {
+            int value = 0;
+            file >> value;
+            catalog.puzzles[p][c] = (unsigned char)((value >= 0 && value <= 9) ? value : 0);
+        }
+        file.ignore(numeric_limits<streamsize>::max(), '\n');
+    }
+    file.close();
+    return catalog;
+}
+
+struct CellSet                                               // 81 cells as a bitset, bit p - cell p
+{
+    uint64_t bits[2] = {0, 0};
+
+    bool has(int p) const { return (bits[p >> 6] >> (p & 63)) & 1; }
+    bool any() const { return (bits[0] | bits[1]) != 0; }
+};
+
+CellSet cellsHolding(const unsigned char* cells, int num)    // Every cell of the board holding num, 16 at a time with SSE2
+{
+    CellSet set;
+    int p = 0;
+#ifdef __SSE2__
+    const __m128i digit = _mm_set1_epi8((char)num);
+    for (; p + 16 <= 81; p += 16)                            // Never straddles the two words
+        set.bits[p >> 6] |= (uint64_t)(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(cells + p)), digit)) << (p & 63);
+#endif
+    for (; p < 81; ++p)
+        if (cells[p] == num)
+            set.bits[p >> 6] |= 1ULL << (p & 63);
+    return set;
+}
+
+enum PencilMode { PENCIL_OFF, PENCIL_MANUAL, PENCIL_AUTO };
+
+class PencilMarks                                            // Digits noted in each empty cell, attached to a game on demand
+{                                                            // (one more pool block, so games without marks stay small)
+    uint16_t marks[81];                                      // Bit n set - n is noted; 0 for a filled cell
+    uint64_t cleared[2];                                     // Undo journal: peers the last move took its digit from
+    uint64_t restored[2];                                    // ...peers given back the digit it overwrote (auto only)
+    uint16_t cellMarks;                                      // ...marks of the moved cell before the move
+    bool journaled;                                          // false - no move since the last reset
+    bool automatic;                                          // true - the game keeps every candidate noted
+    bool edited;                                             // true - marks toggled by hand since the last reset
+
+    static uint16_t usedIn(const Variant& v, const uint16_t* unitMask, int p)
+    {
+        uint16_t used = 0;
+        for (int k = 0; k < v.cellUnitCount[p]; ++k)
+            used |= unitMask[v.cellUnits[p][k]];
+        return used;
+    }
+public:
+    PencilMarks() : journaled(false), automatic(false), edited(false) {};
+
+    static void* operator new(size_t size) { return gamePool.allocate(size); }   // Same blocks as the games
+    static void operator delete(void* p) { gamePool.release(p); }
+
+    bool isAutomatic() const { return automatic; }
+    bool holdsCandidates() const { return automatic && !edited; }   // Every mark is exactly a candidate of the unit masks
+    uint16_t at(int p) const { return marks[p]; }
+    void toggle(int p, int num) { marks[p] ^= (uint16_t)(1 << num); edited = true; }
+
+    void reset(const Variant& v, const unsigned char* cells, const uint16_t* unitMask, bool autoMarks)   // The one full pass: auto notes
+    {                                                                                                    // every candidate, manual nothing
+        automatic = autoMarks;
+        journaled = false;
+        edited = false;
+        for (int p = 0; p < 81; ++p)
+            marks[p] = (automatic && cells[p] == 0) ? (uint16_t)(~usedIn(v, unitMask, p) & 0x3FE) : 0;
+    }
+
+    void afterMove(const Variant& v, const unsigned char* cells, const uint16_t* unitMask, int p, int old)   // Cell p now holds
+    {                                                                                                        // cells[p], it held old
+        uint16_t bit = (uint16_t)(1 << cells[p]);
+        cellMarks = marks[p];
+        marks[p] = 0;
+        cleared[0] = cleared[1] = restored[0] = restored[1] = 0;
+        for (int w = 0; w < 2; ++w)                          // Only the 20 peers can change
+            for (uint64_t peers = v.peers[p][w]; peers != 0; peers &= peers - 1)
+            {
+                int q = w * 64 + __builtin_ctzll(peers);
+                if (marks[q] & bit)
+                {
+                    marks[q] &= (uint16_t)~bit;
+                    cleared[w] |= peers & -peers;
+                }
+                if (automatic && old != 0 && cells[q] == 0 && !((marks[q] >> old) & 1) && !((usedIn(v, unitMask, q) >> old) & 1))
+                {
+                    marks[q] |= (uint16_t)(1 << old);
+                    restored[w] |= peers & -peers;
+                }
+            }
+        journaled = true;
+    }
+
+    void afterUndo(const Variant& v, const unsigned char* cells, const uint16_t* unitMask, int p, int num)   // Cell p is back to cells[p],
+    {                                                                                                        // the undone move put num there
+        uint16_t bit = (uint16_t)(1 << num);
+        if (!journaled)                                      // Resumed game or an earlier move of a branch: made before
+        {                                                    // the marks existed, or its journal was used up
+            if (!automatic)
+                return;
+            marks[p] = (cells[p] == 0) ? (uint16_t)(~usedIn(v, unitMask, p) & 0x3FE) : 0;
+            uint16_t back = (uint16_t)~(1 << cells[p]);      // The digit the undo put back, when it overwrote one
+            for (int w = 0; w < 2; ++w)
+                for (uint64_t peers = v.peers[p][w]; peers != 0; peers &= peers - 1)
+                {
+                    int q = w * 64 + __builtin_ctzll(peers);
+                    if (cells[q] != 0)
+                        continue;
+                    if (!((usedIn(v, unitMask, q) >> num) & 1))
+                        marks[q] |= bit;
+                    if (cells[p] != 0)
+                        marks[q] &= back;
+                }
+            return;
+        }
+        marks[p] = cellMarks;
+        uint16_t old = (uint16_t)~(1 << cells[p]);
+        for (int w = 0; w < 2; ++w)
+        {
+            for (uint64_t set = cleared[w]; set != 0; set &= set - 1)
+                marks[w * 64 + __builtin_ctzll(set)] |= bit;
+            for (uint64_t set = restored[w]; set != 0; set &= set - 1)
+                marks[w * 64 + __builtin_ctzll(set)] &= old;
+        }
+        journaled = false;
+    }
+};
+
+static_assert(sizeof(PencilMarks) <= GAME_BLOCK_BYTES, "Pencil marks must fit one pool block");
+
+class MoveTree                                               // Moves made since the first fork, as a tree: each node is one
+{                                                            // move (a diff against its parent), each branch a node it reached
+    struct Node
+    {
+        int parent;                                          // -1 for the root, the board the tree started from
+        int depth;
+        unsigned char cell, value, before;                   // The move that leads here from the parent
+    };
+    vector<Node> nodes;
+    vector<int> tips;                                        // Node reached by branch b at tips[b - 1]
+    vector<int> path;                                        // Scratch for switchTo, kept to avoid reallocating
+    int branch;                                              // Branch being played, 1-based
+
+    int at() const { return tips[branch - 1]; }
+public:
+    MoveTree(int lastCell, int lastValue, int lastBefore) : tips(1, 0), branch(1)   // lastCell - the game's undo journal, so
+    {                                                                               // undo still reaches the move before the fork
+        nodes.push_back({-1, 0, 0, 0, 0});
+        if (lastCell != NO_UNDO)
+            onMove(lastCell, lastValue, lastBefore);
+    }
+
+    int current() const { return branch; }
+    int count() const { return (int)tips.size(); }
+    int depth() const { return nodes[at()].depth; }
+    size_t bytes() const { return nodes.capacity() * sizeof(Node) + tips.capacity() * sizeof(int); }
+
+    bool lastMove(int& cell, int& before) const              // false - back at the root
+    {
+        const Node& node = nodes[at()];
+        cell = node.cell;
+        before = node.before;
+        return node.parent >= 0;
+    }
+
+    int fork()                                               // New branch at the current node, played from now on
+    {
+        tips.push_back(at());
+        branch = (int)tips.size();
+        return branch;
+    }
+
+    void onMove(int cell, int value, int before)
+    {
+        nodes.push_back({at(), depth() + 1, (unsigned char)cell, (unsigned char)value, (unsigned char)before});
+        tips[branch - 1] = (int)nodes.size() - 1;
+    }
+
+    bool back(int& cell, int& before)                        // Steps the branch back one move; false - at the root
+    {
+        if (!lastMove(cell, before))
+            return false;
+        tips[branch - 1] = nodes[at()].parent;
+        return true;
+    }
+
+    template <typename Place>
+    void switchTo(int b, Place&& place)                      // place(cell, value): undoes moves up to the common ancestor,
+    {                                                        // then replays down to branch b's node
+        int from = at(), to = tips[b - 1];
+        path.clear();
+        while (from != to)
+            if (nodes[from].depth >= nodes[to].depth)
+            {
+                place(nodes[from].cell, nodes[from].before);
+                from = nodes[from].parent;
+            }
+            else
+            {
+                path.push_back(to);
+                to = nodes[to].parent;
+            }
+        for (auto it = path.rbegin(); it != path.rend(); ++it)
+            place(nodes[*it].cell, nodes[*it].value);
+        branch = b;
+    }
+};
+
+// Rules that only some grids have are overloads on the grid type; the Samurai side is in SAMURAI.
+inline int cellAt(const Variant&, int row, int col) { return row * 9 + col; }
+
+inline bool cageAllows(const Variant& v, const unsigned char* cells, int p, int num)   // Killer: the cage can still add up
+{
+    return v.cageOf[p] == 0 || ((cageCandidatesAt(v, cells, p) >> num) & 1);
+}
+
+inline bool cagesAddUp(const Variant& v, const unsigned char* cells)   // Killer: every cage adds up to its sum
+{
+    for (int c = 1; c <= v.cageCount; c++)
+    {
+        int sum = 0;
+        for (int i = 0; i < v.cageSize[c]; i++)
+            sum += cells[v.cageCells[c][i]];
+        if (sum != v.cageSum[c])
+            return false;
+    }
+    return true;
+}
+
+inline int unitsOf(const Variant& v) { return v.unitCount; }
+
+// Board state and move rules shared by Sudoku and Samurai. Grid is a Variant or the SamuraiLayout,
+// which both list the units of every cell (see searchBoard), so cells, clues, unit masks, moves,
+// undo and the solved test are written once for both boards.
+template <typename Grid>
+class GridGame
+{
+protected:
+    typedef typename conditional<(Grid::CELLS < 255), unsigned char, uint16_t>::type CellIndex;   // Samurai cells go past 255
+    static constexpr CellIndex NO_UNDO_CELL = (CellIndex)~0;  // NO_UNDO on a 9x9 grid
+
+    const Grid* variant;                                     // Units of the grid, shared
+    unsigned char current[Grid::CELLS];
+    uint64_t clues[(Grid::CELLS + 63) / 64];                 // Bit p set - cell p is an original clue
+    uint16_t unitMask[Grid::UNITS];
+    unsigned char mistakeCount;
+    CellIndex undoCell;                                      // Cell changed by the last move, NO_UNDO_CELL if none
+    unsigned char undoValue;                                 // Value that cell had before the last move
+
+    int cellOf(int row, int col) const { return cellAt(*variant, row, col); }   // -1 - gap between Samurai grids
+
+    int usedDigits(int p) const                              // Digits already in any unit of cell p
+    {
+        int used = 0;
+        for (int k = 0; k < variant->cellUnitCount[p]; ++k)
+            used |= unitMask[variant->cellUnits[p][k]];
+        return used;
+    }
+
+    void place(int p, int num)                               // Writes a cell and keeps the unit masks in step
+    {
+        int old = current[p];
+        for (int k = 0; k < variant->cellUnitCount[p]; ++k)
+        {
+            uint16_t& mask = unitMask[variant->cellUnits[p][k]];
+            mask = (uint16_t)(((mask & ~(1 << old)) | (1 << num)) & 0x3FE);   // Bit 0 stands for an empty cell
+        }
+        current[p] = (unsigned char)num;
+    }
+
+    void startFromCurrent()                                  // The digits in current become the clues of a new game
+    {
+        memset(clues, 0, sizeof(clues));
+        for (int p = 0; p < Grid::CELLS; ++p)
+            if (current[p] != 0)
+                clues[p >> 6] |= 1ULL << (p & 63);
+        rebuildMasks();
+        undoCell = NO_UNDO_CELL;
+        mistakeCount = 0;
+    }
+
+    bool rebuildMasks()                                      // false - a player's digit repeats in some unit
+    {
+        memset(unitMask, 0, sizeof(unitMask));
+        for (int pass = 0; pass < 2; ++pass)                 // Clues first: a clash among clues is tolerated,
+            for (int p = 0; p < Grid::CELLS; ++p)            // a clash with a player's digit is not
+            {
+                int num = current[p];
+                bool clue = (clues[p >> 6] >> (p & 63)) & 1;
+                if (num == 0 || clue != (pass == 0))
+                    continue;
+                if (pass == 1 && (((usedDigits(p) >> num) & 1) || !cageAllows(*variant, current, p, num)))
+                    return false;
+                for (int k = 0; k < variant->cellUnitCount[p]; ++k)
+                    unitMask[variant->cellUnits[p][k]] |= 1 << num;
+            }
+        return true;
+    }
+public:
+    GridGame(const Grid* g = nullptr, int mistake = 0) : variant(g), mistakeCount((unsigned char)mistake), undoCell(NO_UNDO_CELL), undoValue(0) {};
+
+    bool undoMove()                                          // true - prevoius to current
+    {                                                        // flase - no moves to undo
+        if (undoCell == NO_UNDO_CELL)
+            return false;
+        place(undoCell, undoValue);
+        undoCell = NO_UNDO_CELL;
+        return true;
+    }
+
+    bool isOriginalCell(int row, int col) const              // true - change in ogiginal
+    {                                                        // false - no change in original
+        int p = cellOf(row, col);
+        return (clues[p >> 6] >> (p & 63)) & 1;
+    }
+
+    bool isValidMove(int row, int col, int num) const        // true - all check pass
+    {                                                        // false - any check fails
+        if (isOriginalCell(row, col))                        // Check if cell is editable (not part of original puzzle)
+            return false;
+
+        int p = cellOf(row, col);
+        if ((usedDigits(p) >> num) & 1)                      // Every unit of the cell in one test (both grids of a shared Samurai box)
+            return false;
+        return cageAllows(*variant, current, p, num);
+    }
+
+    bool makeMove(int row, int col, int num)
+    {
+        if (isValidMove(row - 1, col - 1, num))             // true - journals the old value and edits current
+        {
+            int p = cellOf(row - 1, col - 1);
+            undoCell = (CellIndex)p;
+            undoValue = current[p];
+            place(p, num);
+            return true;
+        }
+        return false;
+    }
+
+    bool isSolved() const                                    // Every unit holds all of 1-9
+    {
+        for (int u = 0; u < unitsOf(*variant); u++)
+            if (unitMask[u] != 0x3FE)
+                return false;
+        return cagesAddUp(*variant, current);
+    }
+
+    int getMistakeCount() const { return mistakeCount; }
+    int increaseMistakeCount() { return ++mistakeCount; }
+    int getCell(int row, int col) const { int p = cellOf(row, col); return p < 0 ? 0 : current[p]; }
+    const unsigned char* getCells() const { return current; }
+    int getUndoCell() const { return undoCell; }
+    int getUndoValue() const { return undoValue; }
+    uint16_t unitDigits(int u) const { return unitMask[u]; }
+};
+
+class Sudoku : public GridGame<Variant>
+{
+protected:
+    unsigned char difficulty;                                // First, so it fills the padding at the end of GridGame
+    const unsigned char* original;                           // Points into the shared PuzzleCatalog (the shipped level)
+    long long level;                                         // Level id, see GRID TRANSFORMS
+    PencilMarks* pencil;                                     // nullptr - no pencil marks, the usual case
+    MoveTree* tree;                                          // nullptr - never forked, one-step undo only
+
+    void syncUndo()                                          // The one-step journal follows the branch's last move, so
+    {                                                        // snapshots and undo see it as usual
+        int cell, before;
+        if (tree->lastMove(cell, before))
+        {
+            undoCell = (unsigned char)cell;
+            undoValue = (unsigned char)before;
+        }
+        else
+            undoCell = NO_UNDO;
+    }
+
+    void startFromCurrent()                                  // A new game: also fresh pencil marks and no branches
+    {
+        GridGame::startFromCurrent();
+        if (pencil != nullptr)
+            pencil->reset(*variant, current, unitMask, pencil->isAutomatic());
+        delete tree;
+        tree = nullptr;
+    }
+public:
+    static const int SIDE = 9;                               // Rows and columns on the board, see Samurai
+
+    Sudoku() : pencil(nullptr), tree(nullptr) {};                                                                 // Default Constructor
+    Sudoku(int diff, long long lvl, int mistake = 0) : GridGame(&classicVariant(), mistake), difficulty(diff), original(nullptr), level(lvl), pencil(nullptr), tree(nullptr) {};       // Constructor with initialisation list
+    Sudoku(const Sudoku&) = delete;                              // Would share the pencil marks and branches
+    Sudoku& operator=(const Sudoku&) = delete;
+    virtual ~Sudoku() { delete pencil; delete tree; }            // Virtual Destructor, games are deleted through Sudoku*
+
+    static void* operator new(size_t size) { return gamePool.allocate(size); }      // Games come from the GamePool
+    static void operator delete(void* p) { gamePool.release(p); }
+
+    virtual const unsigned char* getSudoku() = 0;                // Pure Virtual Method
+
+    void initializeSudoku(const unsigned char* puzzle, const Variant& rules = classicVariant())   // puzzle - the shipped level
+    {
+        original = puzzle;                                    // Shared, never copied
+        variant = &rules;
+        levelCells(current);
+        startFromCurrent();
+    }
+    void levelCells(unsigned char* out) const                // The level's clues, derived from the shipped puzzle
+    {
+        if (levelVariation(level) == 0)
+            memcpy(out, original, 81);
+        else
+            levelTransform(level, *variant).apply(original, out);
+    }
+
+    bool undoMove()                                          // Also keeps pencil marks and branches in step
+    {
+        int cell = undoCell, num = (undoCell == NO_UNDO) ? 0 : current[cell];
+        if (!GridGame::undoMove())
+            return false;
+        if (pencil != nullptr)
+            pencil->afterUndo(*variant, current, unitMask, cell, num);
+        if (tree != nullptr)                                 // Branches remember every move, so undo can go on
+        {
+            int before;
+            tree->back(cell, before);
+            syncUndo();
+        }
+        return true;
+    }
+
+    int fork()                                               // Tries a new branch from the current board, returns its number
+    {                                                        // (1 is the line played before the first fork)
+        if (tree == nullptr)
+            tree = new MoveTree(undoCell, (undoCell == NO_UNDO) ? 0 : current[undoCell], undoValue);
+        return tree->fork();
+    }
+
+    bool switchBranch(int b)                                 // false - no such branch
+    {
+        if (b < 1 || b > getBranchCount())
+            return false;
+        if (tree != nullptr && b != tree->current())
+        {
+            tree->switchTo(b, [&](int cell, int value) { place(cell, value); });
+            syncUndo();
+            if (pencil != nullptr)                           // Any number of cells changed
+                pencil->reset(*variant, current, unitMask, pencil->isAutomatic());
+        }
+        return true;
+    }
+
+    int getBranch() const { return (tree == nullptr) ? 1 : tree->current(); }
+    int getBranchCount() const { return (tree == nullptr) ? 1 : tree->count(); }
+    const MoveTree* getMoveTree() const { return tree; }
+
+    bool hasCell(int, int) const { return true; }            // No gaps on a 9x9 board
+
+    CellSet conflictsOf(int row, int col, int num) const     // Why isValidMove says no: the peers holding num or,
+    {                                                        // for Killer, the filled cells of a cage that cannot add up
+        CellSet set;
+        int p = row * 9 + col;
+        if ((usedDigits(p) >> num) & 1)                      // One mask test per unit, nothing more when there is no clash
+        {
+            set = cellsHolding(current, num);
+            set.bits[0] &= variant->peers[p][0];
+            set.bits[1] &= variant->peers[p][1];
+        }
+        else if (variant->cageOf[p] != 0 && !((cageCandidatesAt(*variant, current, p) >> num) & 1))
+        {
+            int cage = variant->cageOf[p];
+            for (int i = 0; i < variant->cageSize[cage]; ++i)
+            {
+                int q = variant->cageCells[cage][i];
+                if (q != p && current[q] != 0)
+                    set.bits[q >> 6] |= 1ULL << (q & 63);
+            }
+        }
+        return set;
+    }
+
+    bool makeMove(int row, int col, int num)                 // Also keeps pencil marks and branches in step
+    {
+        if (!GridGame::makeMove(row, col, num))
+            return false;
+        if (pencil != nullptr)
+            pencil->afterMove(*variant, current, unitMask, undoCell, undoValue);
+        if (tree != nullptr)
+            tree->onMove(undoCell, num, undoValue);
+        return true;
+    }
+
+    // Getter Methods
+    string getDifficulty() const { return DIFFICULTY_NAMES[difficulty]; }
+    int getDifficultyIndex() const { return difficulty; }
+    long long getLevel() const { return level; }
+    const Variant& getVariant() const { return *variant; }
+    const PencilMarks* getPencilMarks() const { return pencil; }
+    PencilMode getPencilMode() const { return (pencil == nullptr) ? PENCIL_OFF : pencil->isAutomatic() ? PENCIL_AUTO : PENCIL_MANUAL; }
+
+    void setPencilMode(PencilMode mode)                      // Auto notes every candidate, manual starts with no marks
+    {
+        if (mode == PENCIL_OFF)
+        {
+            delete pencil;
+            pencil = nullptr;
+            return;
+        }
+        if (pencil == nullptr)
+            pencil = new PencilMarks();
+        pencil->reset(*variant, current, unitMask, mode == PENCIL_AUTO);
+    }
+
+    bool togglePencilMark(int row, int col, int num)         // false - the cell is filled
+    {
+        int p = (row - 1) * 9 + (col - 1);
+        if (current[p] != 0)
+            return false;
+        if (pencil == nullptr)
+            setPencilMode(PENCIL_MANUAL);
+        pencil->toggle(p, num);
+        return true;
+    }
+
+    uint16_t candidates(int p) const                         // Digits still allowed in cell p, 0 if it is filled
+    {
+        if (current[p] != 0)
+            return 0;
+        return (uint16_t)(~usedDigits(p) & cageCandidatesAt(*variant, current, p) & 0x3FE);
+    }
+
+    bool restoreState(const unsigned char* cells, int lastCell, int lastValue, int mistakes)   // Used when resuming a saved game
+    {                                                                                          // false - boards do not match the clues
+        unsigned char given[81];                             // The clues, as the current board still holds them
+        for (int p = 0; p < 81; p++)
+            given[p] = ((clues[p >> 6] >> (p & 63)) & 1) ? current[p] : 0;
+        for (int p = 0; p < 81; p++)
+            if (given[p] != 0 && cells[p] != given[p])
+                return false;
+        if (lastCell != NO_UNDO && (lastCell > 80 || given[lastCell] != 0))
+            return false;
+        memcpy(current, cells, 81);
+        if (!rebuildMasks())
+        {
+            memcpy(current, given, 81);                      // Back to the start of the level
+            startFromCurrent();
+            return false;
+        }
+        undoCell = (unsigned char)lastCell;
+        undoValue = (unsigned char)lastValue;
+        mistakeCount = (unsigned char)mistakes;
+        if (pencil != nullptr)
+            pencil->reset(*variant, current, unitMask, pencil->isAutomatic());
+        delete tree;                                         // Snapshots keep the board, not the branches
+        tree = nullptr;
+        return true;
+    }
+};
+
+// ---------------- EASY, MEDIUM, HARD CLASSES --------------
+class Easy : public Sudoku
+{
+public:
+    Easy(long long lvl) : Sudoku(EASY, lvl) {}          // Base class costructor in initialization list
+    const unsigned char* getSudoku()               // Returns the puzzle of required level
+    {
+        static const PuzzleCatalog puzzles = loadPuzzleFile("easy.txt");      // Read once, shared by every Easy game
+        initializeSudoku(puzzles.puzzles[baseLevel(level) - 1], puzzles.variants[baseLevel(level) - 1]);
+        return current;
+    }
+};
+
+class Medium : public Sudoku
+{
+public:
+    Medium(long long lvl) : Sudoku(MEDIUM, lvl) {}
+    const unsigned char* getSudoku()
+    {
+        static const PuzzleCatalog puzzles = loadPuzzleFile("medium.txt");
+        initializeSudoku(puzzles.puzzles[baseLevel(level) - 1], puzzles.variants[baseLevel(level) - 1]);
+        return current;
+    }
+};
+
+class Hard : public Sudoku
+{
+public:
+    Hard(long long lvl) : Sudoku(HARD, lvl) {}
+    const unsigned char* getSudoku()
+    {
+        static const PuzzleCatalog puzzles = loadPuzzleFile("hard.txt");
+        initializeSudoku(puzzles.puzzles[baseLevel(level) - 1], puzzles.variants[baseLevel(level) - 1]);
+        return current;
+    }
+};
+
+static_assert(sizeof(Easy) <= 256 && sizeof(Medium) <= 256 && sizeof(Hard) <= 256,
+              "A game must stay within 256 bytes");        // Memory budget for hosting many sessions
+
+// ---------------- METRICS --------------------------------
+// Counters and latency histograms for the game engine and solver.
+// Each thread writes only its own MetricsShard (plain relaxed stores, no locked instructions);
+// an export sums every shard ever created and prints Prometheus text format.
+// Histograms are HDR-style: one row per power of two nanoseconds, split into 16 linear steps,
+// so every recorded latency keeps about 6% precision from 1 ns up to about 2 hours.
+enum CounterKind { COUNT_MOVES, COUNT_MISTAKES, COUNT_UNDOS, COUNT_TIMEOUTS, COUNT_GAMES_SOLVED,
+                   COUNT_POOL_GENERATED, COUNT_POOL_STARVED, COUNT_HINTS, COUNTER_KINDS };
+enum LatencyKind { LATENCY_MOVE, LATENCY_RENDER, LATENCY_SOLVE, LATENCY_KINDS };
+
+const char* const COUNTER_NAMES[] = {"sudoku_moves_total", "sudoku_mistakes_total", "sudoku_undos_total",
+                                     "sudoku_timeouts_total", "sudoku_games_solved_total",
+                                     "sudoku_pool_generated_total", "sudoku_pool_starved_total", "sudoku_hints_total"};
+const char* const LATENCY_NAMES[] = {"sudoku_move_latency_seconds", "sudoku_render_latency_seconds",
+                                     "sudoku_solve_latency_seconds"};
+
+const int HISTOGRAM_SUB_BUCKETS = 16;
+const int HISTOGRAM_ROWS = 40;
+const int HISTOGRAM_BUCKETS = HISTOGRAM_ROWS * HISTOGRAM_SUB_BUCKETS;
+
+size_t puzzlePoolDepth(int difficulty);                      // Gauge, defined with the PuzzlePool
+
+inline void bumpCounter(atomic<uint64_t>& c, uint64_t by = 1)        // Single writer, so no locked add needed
+{
+    c.store(c.load(memory_order_relaxed) + by, memory_order_relaxed);
+}
+
+class LatencyHistogram
+{
+    atomic<uint64_t> buckets[HISTOGRAM_BUCKETS];
+    atomic<uint64_t> count;
+    atomic<uint64_t> sumNanos;
+public:
+    LatencyHistogram() : count(0), sumNanos(0) { for (auto& b : buckets) b.store(0, memory_order_relaxed); }
+
+    static int bucketOf(uint64_t nanos)
+    {
+        if (nanos < HISTOGRAM_SUB_BUCKETS)
+            return (int)nanos;                               // Row 0 is exact
+        int row = 63 - __builtin_clzll(nanos) - 3;           // Top 4 bits give the linear step
+        if (row >= HISTOGRAM_ROWS)
+            return HISTOGRAM_BUCKETS - 1;
+        return row * HISTOGRAM_SUB_BUCKETS + (int)((nanos >> (row - 1)) & (HISTOGRAM_SUB_BUCKETS - 1));
+    }
+
+    static uint64_t bucketUpperNanos(int bucket)             // Largest latency that lands in this bucket
+    {
+        int row = bucket / HISTOGRAM_SUB_BUCKETS, step = bucket % HISTOGRAM_SUB_BUCKETS;
+        if (row == 0)
+            return step;
+        return ((uint64_t)(HISTOGRAM_SUB_BUCKETS + step + 1) << (row - 1)) - 1;
+    }
+
+    void record(uint64_t nanos)
+    {
+        bumpCounter(buckets[bucketOf(nanos)]);
+        bumpCounter(count);
+        bumpCounter(sumNanos, nanos);
+    }
+
+    void addTo(vector<uint64_t>& totals, uint64_t& totalCount, uint64_t& totalNanos) const
+    {
+        for (int b = 0; b < HISTOGRAM_BUCKETS; ++b)
+            totals[b] += buckets[b].load(memory_order_relaxed);
+        totalCount += count.load(memory_order_relaxed);
+        totalNanos += sumNanos.load(memory_order_relaxed);
+    }
+};
+
+struct MetricsShard
+{
+    atomic<uint64_t> counters[3][COUNTER_KINDS];             // [difficulty][kind]
+    atomic<uint64_t> solverRuns;
+    LatencyHistogram latency[LATENCY_KINDS];
+
+    MetricsShard() : solverRuns(0)
+    {
+        for (auto& row : counters)
+            for (auto& c : row)
+                c.store(0, memory_order_relaxed);
+    }
+};
+
+mutex metricsRegistryLock;
+vector<MetricsShard*> metricsRegistry;                       // Shards are never freed, counts outlive their thread
+
+MetricsShard& threadMetrics()
+{
+    thread_local MetricsShard* shard = nullptr;
+    if (shard == nullptr)
+    {
+        shard = new MetricsShard();
+        lock_guard<mutex> guard(metricsRegistryLock);
+        metricsRegistry.push_back(shard);
+    }
+    return *shard;
+}
+
+inline void countEvent(int difficulty, CounterKind kind)
+{
+    bumpCounter(threadMetrics().counters[difficulty][kind]);
+}
+
+inline uint64_t nowNanos()
+{
+    return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+class LatencyTimer                                           // Records the lifetime of the scope it lives in
+{
+    LatencyKind kind;
+    uint64_t start;
+public:
+    LatencyTimer(LatencyKind k) : kind(k), start(nowNanos()) {};
+    ~LatencyTimer() { threadMetrics().latency[kind].record(nowNanos() - start); }
+};
+
+string exportMetrics()                                       // Prometheus text exposition format
+{
+    lock_guard<mutex> guard(metricsRegistryLock);
+    string text;
+    char line[160];
+
+    for (int k = 0; k < COUNTER_KINDS; ++k)
+    {
+        text += string("# TYPE ") + COUNTER_NAMES[k] + " counter\n";
+        for (int d = 0; d < 3; ++d)
+        {
+            uint64_t total = 0;
+            for (MetricsShard* shard : metricsRegistry)
+                total += shard->counters[d][k].load(memory_order_relaxed);
+            snprintf(line, sizeof(line), "%s{difficulty=\"%s\"} %llu\n", COUNTER_NAMES[k], DIFFICULTY_NAMES[d], (unsigned long long)total);
+            text += line;
+        }
+    }
+
+    uint64_t runs = 0;
+    for (MetricsShard* shard : metricsRegistry)
+        runs += shard->solverRuns.load(memory_order_relaxed);
+    snprintf(line, sizeof(line), "# TYPE sudoku_solver_runs_total counter\nsudoku_solver_runs_total %llu\n", (unsigned long long)runs);
+    text += line;
+
+    text += "# TYPE sudoku_pool_depth gauge\n";
+    for (int d = 0; d < 3; ++d)
+    {
+        snprintf(line, sizeof(line), "sudoku_pool_depth{difficulty=\"%s\"} %zu\n", DIFFICULTY_NAMES[d], puzzlePoolDepth(d));
+        text += line;
+    }
+
+    for (int k = 0; k < LATENCY_KINDS; ++k)
+    {
+        vector<uint64_t> totals(HISTOGRAM_BUCKETS, 0);
+        uint64_t count = 0, nanos = 0;
+        for (MetricsShard* shard : metricsRegistry)
+            shard->latency[k].addTo(totals, count, nanos);
+
+        text += string("# TYPE ") + LATENCY_NAMES[k] + " histogram\n";
+        uint64_t cumulative = 0;
+        for (int b = 0; b < HISTOGRAM_BUCKETS; ++b)
+        {
+            cumulative += totals[b];
+            bool rowEnd = b % HISTOGRAM_SUB_BUCKETS == HISTOGRAM_SUB_BUCKETS - 1;
+            if (!rowEnd || b / HISTOGRAM_SUB_BUCKETS < 4)    // Prometheus gets one le per power of two from 256 ns
+                continue;
+            snprintf(line, sizeof(line), "%s_bucket{le=\"%.9g\"} %llu\n", LATENCY_NAMES[k],
+                     (LatencyHistogram::bucketUpperNanos(b) + 1) / 1e9, (unsigned long long)cumulative);
+            text += line;
+            if (cumulative == count)
+                break;
+        }
+        snprintf(line, sizeof(line), "%s_bucket{le=\"+Inf\"} %llu\n%s_sum %.9f\n%s_count %llu\n",
+                 LATENCY_NAMES[k], (unsigned long long)count, LATENCY_NAMES[k], nanos / 1e9,
+                 LATENCY_NAMES[k], (unsigned long long)count);
+        text += line;
+    }
+    return text;
+}
+
+bool exportMetricsToFile(const string& path)
+{
+    ofstream file(path);
+    file << exportMetrics();
+    return bool(file);
+}
+
+// ---------------- SOLVER ---------------------------------
+// Depth-first search on the unit masks of the puzzle's variant, always branching on the empty
+// cell with the fewest candidates. The search stack lives in the thread's SearchArena.
+// For killer grids every cage and derived sum group also keeps the union of its digit sets
+// that are still possible, taken from the precomputed CageCombinations.
+//
+// Every solver takes a trace policy as template parameter. NoTrace has empty inline hooks and
+// solveBoard(), plain or bounded, records no metrics, so it compiles to the bare search for the
+// generator, uniqueness checks and the engines inside bigger solves. A request counts one
+// solver run and one solve latency where it enters: solveBoardTraced() (service, batch), the
+// portfolio's solve() and solveSamurai(). SearchStats counts the search and ChromeTrace
+// additionally samples it into Chrome trace_event JSON (chrome://tracing, Perfetto).
+//
+// Any search can be bounded by a Deadline: a point in time, a CancelToken another thread can
+// trip, or both. Bounded<Trace> adds one to a trace policy; the search asks it once per node,
+// which costs a counter test, and it reads the clock and token every DEADLINE_CHECK_NODES
+// nodes. A bounded search returns the solutions it found so far and a SolveStatus saying why.
+struct SearchFrame
+{
+    uint16_t cell;
+    uint16_t candidates;                                     // Digits not tried yet at this cell
+};
+
+int countBits(unsigned int mask)
+{
+    return __builtin_popcount(mask);
+}
+
+struct NoTrace
+{
+    void beginPhase(const char*) {}
+    void endPhase() {}
+    void onNode(int) {}                                      // A cell was filled at this depth
+    void onGuess() {}                                        // ...choosing between two or more digits
+    void onSingle() {}                                       // ...that had only one candidate left (propagation)
+    void onBacktrack() {}
+    bool cancelled() { return false; }                       // true - give up the search, see SOLVER PORTFOLIO
+};
+
+enum SolveStatus { SOLVE_COMPLETE, SOLVE_TIMEOUT, SOLVE_CANCELLED };
+const char* const SOLVE_STATUS_NAMES[] = {"complete", "timeout", "cancelled"};
+const unsigned DEADLINE_CHECK_NODES = 256;
+
+class CancelToken
+{
+    atomic<bool> cancelled;
+    const CancelToken* parent;                               // Cancelling the parent cancels this one too
+public:
+    CancelToken(const CancelToken* p = nullptr) : cancelled(false), parent(p) {};
+
+    void cancel() { cancelled.store(true, memory_order_relaxed); }
+    bool isCancelled() const { return cancelled.load(memory_order_relaxed) || (parent != nullptr && parent->isCancelled()); }
+};
+
+struct Deadline
+{
+    uint64_t atNanos;                                        // nowNanos() to give up at, 0 - no time limit
+    const CancelToken* token;                                // nullptr - cannot be cancelled
+
+    static Deadline none() { return {0, nullptr}; }
+    static Deadline after(uint64_t nanos, const CancelToken* t = nullptr) { return {nowNanos() + nanos, t}; }
+
+    SolveStatus check() const
+    {
+        if (token != nullptr && token->isCancelled())
+            return SOLVE_CANCELLED;
+        return (atNanos != 0 && nowNanos() >= atNanos) ? SOLVE_TIMEOUT : SOLVE_COMPLETE;
+    }
+};
+
+template <typename Trace>
+struct Bounded : Trace                                       // Any trace policy, plus a deadline
+{
+    const Deadline& deadline;
+    unsigned every, countdown;                               // Nodes between checks, nodes left until the next one
+    SolveStatus status;                                      // Why the search stopped early, once it has
+
+    Bounded(const Deadline& d, unsigned checkEvery = DEADLINE_CHECK_NODES)
+        : deadline(d), every(checkEvery), countdown(checkEvery), status(SOLVE_COMPLETE) {};
+
+    bool cancelled()
+    {
+        if (status == SOLVE_COMPLETE && --countdown == 0)
+        {
+            countdown = every;
+            status = deadline.check();
+        }
+        return status != SOLVE_COMPLETE;
+    }
+};
+
+struct SearchStats
+{
+    long long nodes, guesses, singles, backtracks;
+    int maxDepth;
+    const char* phase;
+    uint64_t phaseStart;
+    vector<pair<const char*, uint64_t>> phaseNanos;          // Time spent per phase, in order
+
+    SearchStats() : nodes(0), guesses(0), singles(0), backtracks(0), maxDepth(0), phase(nullptr), phaseStart(0) {};
+
+    void beginPhase(const char* name) { phase = name; phaseStart = nowNanos(); }
+    void endPhase() { phaseNanos.push_back({phase, nowNanos() - phaseStart}); }
+    void onNode(int depth) { ++nodes; maxDepth = max(maxDepth, depth); }
+    void onGuess() { ++guesses; }
+    void onSingle() { ++singles; }
+    void onBacktrack() { ++backtracks; }
+    bool cancelled() { return false; }
+
+    void print(ostream& out) const
+    {
+        out << "nodes " << nodes << ", guesses " << guesses << ", singles " << singles
+            << ", backtracks " << backtracks << ", max depth " << maxDepth << "\n";
+        for (auto& p : phaseNanos)
+            out << "  " << p.first << ": " << p.second / 1000.0 << " us\n";
+    }
+};
+
+class ChromeTrace : public SearchStats                      // Stats plus a sampled timeline
+{
+    string events;
+    uint64_t origin;
+    long long sampleEvery;                                   // Emit a counter event every N nodes
+
+    void addEvent(const string& json)
+    {
+        if (!events.empty())
+            events += ",\n";
+        events += json;
+    }
+    string micros(uint64_t nanos) const
+    {
+        char text[32];
+        snprintf(text, sizeof(text), "%.3f", (nanos - origin) / 1000.0);
+        return text;
+    }
+public:
+    ChromeTrace(long long sample = 64) : origin(nowNanos()), sampleEvery(max(sample, 1LL)) {};
+
+    void endPhase()
+    {
+        uint64_t end = nowNanos();
+        SearchStats::endPhase();
+        char dur[32];
+        snprintf(dur, sizeof(dur), "%.3f", (end - phaseStart) / 1000.0);
+        addEvent(string("{\"name\":\"") + phase + "\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":" + micros(phaseStart) + ",\"dur\":" + dur + "}");
+    }
+    void onNode(int depth)
+    {
+        SearchStats::onNode(depth);
+        if (nodes % sampleEvery == 0)
+            addEvent("{\"name\":\"search\",\"ph\":\"C\",\"pid\":1,\"tid\":1,\"ts\":" + micros(nowNanos()) +
+                     ",\"args\":{\"depth\":" + to_string(depth) + ",\"guesses\":" + to_string(guesses) +
+                     ",\"backtracks\":" + to_string(backtracks) + "}}");
+    }
+
+    bool write(const string& path) const
+    {
+        ofstream file(path);
+        file << "{\"traceEvents\":[\n" << events << "\n]}\n";
+        return bool(file);
+    }
+};
+
+struct FullBoard                                             // A filled board is one solution
+{
+    int operator()(const unsigned char*) { return 1; }
+};
+
+// Grid is a Variant or the SamuraiLayout: cellUnits/cellUnitCount for CELLS cells over UNITS
+// units. Only the first SEARCH_CELLS cells are branched on; once they are all filled,
+// complete(cells) says how many solutions that gives (the Samurai outer grids are solved then).
+template <typename Trace, bool killer, typename Grid, typename Complete>   // killer - Grid has sum groups to keep in step
+int searchBoard(const unsigned char* puzzle, unsigned char* solution, int limit, Trace& trace, const Grid& variant, Complete& complete)
+{
+    trace.beginPhase("setup");
+    unsigned char cells[Grid::CELLS];
+    uint16_t masks[Grid::UNITS] = {};
+    uint16_t groupPlaced[MAX_SUM_GROUPS + 1], groupAllowed[MAX_SUM_GROUPS + 1];   // Killer cages and derived groups
+    int groupLeft[MAX_SUM_GROUPS + 1], groupSumLeft[MAX_SUM_GROUPS + 1];
+    auto usedDigits = [&](int p)                             // Row, column and region always come first
+    {
+        const unsigned char* units = variant.cellUnits[p];
+        int used = masks[units[0]] | masks[units[1]] | masks[units[2]];
+        for (int k = 3; k < variant.cellUnitCount[p]; ++k)
+            used |= masks[units[k]];
+        return used;
+    };
+    auto toggle = [&](int p, int num)                        // Adds or removes digit num in every unit of cell p
+    {
+        const unsigned char* units = variant.cellUnits[p];
+        masks[units[0]] ^= 1 << num;
+        masks[units[1]] ^= 1 << num;
+        masks[units[2]] ^= 1 << num;
+        for (int k = 3; k < variant.cellUnitCount[p]; ++k)
+            masks[units[k]] ^= 1 << num;
+        if constexpr (killer)
+            for (int k = 0; k < variant.cellSumGroupCount[p]; ++k)   // Narrow each group to the digit sets still possible
+            {
+                int g = variant.cellSumGroups[p][k];
+                groupPlaced[g] ^= 1 << num;
+                bool added = (groupPlaced[g] >> num) & 1;
+                groupLeft[g] += added ? -1 : 1;
+                groupSumLeft[g] += added ? -num : num;
+                groupAllowed[g] = cageCandidates(groupLeft[g], groupSumLeft[g], groupPlaced[g]);
+            }
+    };
+    auto sumAllowed = [&](int p)
+    {
+        int allowed = 0x3FE;
+        if constexpr (killer)
+            for (int k = 0; k < variant.cellSumGroupCount[p]; ++k)
+                allowed &= groupAllowed[variant.cellSumGroups[p][k]];
+        return allowed;
+    };
+    if constexpr (killer)
+        for (int g = 1; g <= variant.sumGroupCount; ++g)
+        {
+            groupPlaced[g] = 0;
+            groupLeft[g] = variant.cageSize[g];
+            groupSumLeft[g] = variant.cageSum[g];
+            groupAllowed[g] = cageCandidates(groupLeft[g], groupSumLeft[g], 0);
+        }
+    int empty = 0;
+    for (int p = 0; p < Grid::CELLS; ++p)
+    {
+        int num = cells[p] = puzzle[p];
+        if (num == 0)
+        {
+            ++empty;
+            continue;
+        }
+        if (((usedDigits(p) | ~sumAllowed(p)) >> num) & 1)
+        {
+            trace.endPhase();
+            return 0;
+        }
+        toggle(p, num);
+    }
+
+    SearchArena::Mark arenaMark = searchArena.mark();        // Handed back on return, so searches can nest
+    SearchFrame* stack = searchArena.allocateArray<SearchFrame>(empty + 1);
+    int depth = 0;
+    int found = 0;
+    trace.endPhase();
+    trace.beginPhase("search");
+
+    while (!trace.cancelled())
+    {
+        int best = -1, bestCount = 10;                       // Pick the most constrained empty cell
+        uint16_t bestCandidates = 0;
+        for (int p = 0; p < Grid::SEARCH_CELLS && bestCount > 1; ++p)
+        {
+            if (cells[p] != 0)
+                continue;
+            uint16_t candidates = ~usedDigits(p) & sumAllowed(p) & 0x3FE;
+            int count = countBits(candidates);
+            if (count < bestCount)
+            {
+                best = p;
+                bestCount = count;
+                bestCandidates = candidates;
+            }
+        }
+
+        if (best < 0)                                        // Board full: a solution
+        {
+            int solutions = complete(cells);
+            if (solutions > 0 && found == 0 && solution != nullptr)
+                memcpy(solution, cells, Grid::CELLS);
+            found += solutions;
+            if (found >= limit)
+                break;
+        }
+        else if (bestCount > 0)
+        {
+            stack[depth].cell = (uint16_t)best;
+            stack[depth].candidates = bestCandidates;
+            ++depth;
+            if (bestCount == 1)
+                trace.onSingle();
+            else
+                trace.onGuess();
+        }
+
+        while (depth > 0)                                    // Try the next digit, backtracking as needed
+        {
+            SearchFrame& frame = stack[depth - 1];
+            int p = frame.cell;
+            if (cells[p] != 0)
+            {
+                toggle(p, cells[p]);
+                cells[p] = 0;
+            }
+            if (frame.candidates == 0)
+            {
+                --depth;
+                trace.onBacktrack();
+                continue;
+            }
+            int num = __builtin_ctz(frame.candidates);
+            frame.candidates &= frame.candidates - 1;
+            cells[p] = (unsigned char)num;
+            toggle(p, num);
+            trace.onNode(depth);
+            break;
+        }
+        if (depth == 0)
+            break;
+    }
+    searchArena.rewind(arenaMark);
+    trace.endPhase();
+    return found;
+}
+
+template <typename Trace>
+int searchVariant(const unsigned char* puzzle, unsigned char* solution, int limit, Trace& trace, const Variant& variant)
+{
+    FullBoard complete;
+    if (variant.sumGroupCount > 0)                           // Killer bookkeeping compiled out for every other grid
+        return searchBoard<Trace, true>(puzzle, solution, limit, trace, variant, complete);
+    return searchBoard<Trace, false>(puzzle, solution, limit, trace, variant, complete);
+}
+
+template <typename Trace>
+int solveBoardTraced(const unsigned char* puzzle, unsigned char* solution, int limit, Trace& trace,
+                     const Variant& variant = classicVariant())   // Number of solutions found, at most limit
+{                                                                  // 0 - clues clash or no solution
+    LatencyTimer timer(LATENCY_SOLVE);
+    bumpCounter(threadMetrics().solverRuns);
+    return searchVariant(puzzle, solution, limit, trace, variant);
+}
+
+inline int solveBoard(const unsigned char* puzzle, unsigned char* solution = nullptr, int limit = 1,
+                      const Variant& variant = classicVariant())
+{
+    NoTrace none;                                            // All hooks inline to nothing, no clock reads or counters
+    return searchVariant(puzzle, solution, limit, none, variant);
+}
+
+// Bounded solve or solution count: the solutions found before the deadline, status says if it came.
+inline int solveBoard(const unsigned char* puzzle, unsigned char* solution, int limit, const Deadline& deadline,
+                      SolveStatus& status, const Variant& variant = classicVariant())
+{
+    Bounded<NoTrace> bounded(deadline);
+    int found = searchVariant(puzzle, solution, limit, bounded, variant);
+    status = bounded.status;
+    return found;
+}
+
+// ---------------- GRID GENERATOR -------------------------
+// Random complete grids without a search per grid. A library of seed grids is solved once, each
+// from a few random clues. After that, every grid is one seed grid put through a random
+// GridTransform: digits relabelled, rows shuffled within each band, bands shuffled, the same
+// for columns and stacks, and an optional transposition. That gives 9! * 6^8 * 2 (about 1.2e12)
+// arrangements per seed grid, and every transform is equally likely, so the output is uniform
+// over the grids each seed can reach. All randomness comes from Rng (xoshiro256**). A seed always
+// gives the same grids, and Rng::stream() gives each thread its own sequence that cannot overlap.
+// generatePuzzle() carves a rated puzzle out of such a grid, for the PUZZLE POOL.
+bool isCompleteGrid(const unsigned char* grid, const Variant& variant = classicVariant())   // Every unit holds 1-9
+{
+    for (int u = 0; u < variant.unitCount; ++u)
+    {
+        int mask = 0;
+        for (int i = 0; i < 9; ++i)
+            mask |= 1 << grid[variant.units[u][i]];
+        if (mask != 0x3FE)
+            return false;
+    }
+    return true;
+}
+
+const int SEED_GRIDS = 64;
+
+struct SeedGrids
+{
+    unsigned char grids[SEED_GRIDS][81];
+};
+
+const SeedGrids& seedGrids()                                 // Built once from a fixed seed: the same library in every run
+{
+    static const SeedGrids library = []
+    {
+        SeedGrids lib;
+        Rng rng(0x5EED5EED);
+        const Variant& v = classicVariant();
+        for (int g = 0; g < SEED_GRIDS; ++g)
+        {
+            unsigned char clues[81];
+            do                                               // 11 random clues that do not clash, until they have a solution
+            {
+                memset(clues, 0, sizeof(clues));
+                for (int placed = 0; placed < 11; )
+                {
+                    int p = rng.below(81), num = 1 + rng.below(9);
+                    bool clash = clues[p] != 0;
+                    for (int k = 0; k < v.cellUnitCount[p] && !clash; ++k)
+                        for (int i = 0; i < 9; ++i)
+                            clash = clash || clues[v.units[v.cellUnits[p][k]][i]] == num;
+                    if (!clash)
+                    {
+                        clues[p] = (unsigned char)num;
+                        ++placed;
+                    }
+                }
+            } while (solveBoard(clues, lib.grids[g]) == 0);
+        }
+        return lib;
+    }();
+    return library;
+}
+
+class GridGenerator
+{
+    Rng rng;
+public:
+    GridGenerator(uint64_t seed, int stream = 0) : rng(Rng::stream(seed, stream)) {};
+
+    void next(unsigned char* grid)                           // grid gets 81 cells
+    {
+        const SeedGrids& library = seedGrids();
+        const unsigned char* seed = library.grids[rng.below(SEED_GRIDS)];
+        GridTransform::random(rng).apply(seed, grid);
+    }
+
+    Rng& random() { return rng; }
+};
+
+struct BatchStats : NoTrace                                  // Only what a batch record needs, no timing or allocation
+{
+    long long nodes, guesses;
+    BatchStats() : nodes(0), guesses(0) {};
+    void onNode(int) { ++nodes; }
+    void onGuess() { ++guesses; }
+};
+
+int searchDifficulty(const BatchStats& stats)                // Search effort to solve and prove uniqueness
+{
+    if (stats.guesses == 0)
+        return EASY;
+    return stats.guesses <= 10 ? MEDIUM : HARD;
+}
+
+const char* ratePuzzle(int solutions, const BatchStats& stats)
+{
+    return (solutions != 1) ? "invalid" : DIFFICULTY_NAMES[searchDifficulty(stats)];
+}
+
+// A unique puzzle from one seed: a random grid, then clues taken away in random order as long as
+// the puzzle keeps exactly one solution and rates no harder than target. Returns the difficulty
+// it ended at, lower than target when no removal got there. A seed always gives the same puzzle.
+// Past the deadline it stops removing; the puzzle is still unique, with more clues than it would
+// have had, and status says why.
+int generatePuzzle(uint64_t seed, int target, unsigned char* puzzle,   // puzzle gets 81 cells
+                   const Deadline& deadline = Deadline::none(), SolveStatus* status = nullptr)
+{
+    GridGenerator generator(seed);
+    generator.next(puzzle);
+    Rng& rng = generator.random();
+    unsigned char order[81];
+    for (int i = 0; i < 81; ++i)
+        order[i] = (unsigned char)i;
+    for (int i = 80; i > 0; --i)
+        swap(order[i], order[rng.below(i + 1)]);
+
+    int reached = EASY;
+    Bounded<BatchStats> stats(deadline);
+    for (int p : order)
+    {
+        unsigned char clue = puzzle[p];
+        puzzle[p] = 0;
+        stats.nodes = stats.guesses = 0;
+        int solutions = searchVariant(puzzle, nullptr, 2, stats, classicVariant());   // Internal check, no solver metrics
+        int rating = searchDifficulty(stats);
+        if (solutions != 1 || rating > target || stats.status != SOLVE_COMPLETE)
+            puzzle[p] = clue;                                // Needed, or not proven unneeded in time: put it back
+        else
+            reached = rating;
+        if (stats.status != SOLVE_COMPLETE)
+            break;
+    }
+    if (status != nullptr)
+        *status = stats.status;
+    return reached;
+}
+
+// ---------------- PUZZLE POOL ----------------------------
+// Generating and rating a fresh puzzle takes a few milliseconds, too long and too uneven for the
+// request path. Background producer threads keep a pool of ready puzzles per difficulty instead,
+// so starting a game is one queue pop. Producers fill whichever pool is emptiest until all of
+// them reach the high watermark, then sleep until a pool drops below the low watermark.
+// A pop that finds its pool empty counts as starvation and falls back to a derived level.
+// A pooled puzzle keeps its seed as level id, so save, resume and the move log regenerate it.
+template <typename T, size_t CAPACITY>
+class MpmcQueue                                              // Bounded lock-free queue for any number of producers and
+{                                                            // consumers: a sequence number per slot says whose turn it is
+    static_assert((CAPACITY & (CAPACITY - 1)) == 0, "MpmcQueue capacity must be a power of two");
+
+    struct Slot
+    {
+        atomic<size_t> sequence;                             // pos: free for the push at pos, pos + 1: holds its value
+        T value;
+    };
+    Slot slots[CAPACITY];
+    alignas(64) atomic<size_t> pushPos;                      // Own cache lines, producers and consumers do not share
+    alignas(64) atomic<size_t> popPos;
+public:
+    MpmcQueue() : pushPos(0), popPos(0)
+    {
+        for (size_t i = 0; i < CAPACITY; ++i)
+            slots[i].sequence.store(i, memory_order_relaxed);
+    }
+
+    bool push(const T& value)                                // false - full
+    {
+        size_t pos = pushPos.load(memory_order_relaxed);
+        while (true)
+        {
+            Slot& slot = slots[pos & (CAPACITY - 1)];
+            intptr_t lag = (intptr_t)slot.sequence.load(memory_order_acquire) - (intptr_t)pos;
+            if (lag == 0 && pushPos.compare_exchange_weak(pos, pos + 1, memory_order_relaxed))
+            {
+                slot.value = value;
+                slot.sequence.store(pos + 1, memory_order_release);
+                return true;
+            }
+            if (lag < 0)
+                return false;                                // Slot still holds a value one lap behind
+            if (lag > 0)
+                pos = pushPos.load(memory_order_relaxed);    // Another producer took this position
+        }
+    }
+
+    bool pop(T& value)                                       // false - empty
+    {
+        size_t pos = popPos.load(memory_order_relaxed);
+        while (true)
+        {
+            Slot& slot = slots[pos & (CAPACITY - 1)];
+            intptr_t lag = (intptr_t)slot.sequence.load(memory_order_acquire) - (intptr_t)(pos + 1);
+            if (lag == 0 && popPos.compare_exchange_weak(pos, pos + 1, memory_order_relaxed))
+            {
+                value = slot.value;
+                slot.sequence.store(pos + CAPACITY, memory_order_release);   // Free for the push one lap later
+                return true;
+            }
+            if (lag < 0)
+                return false;
+            if (lag > 0)
+                pos = popPos.load(memory_order_relaxed);
+        }
+    }
+
+    size_t size() const                                      // Approximate while others push and pop
+    {
+        size_t popped = popPos.load(memory_order_relaxed);
+        size_t pushed = pushPos.load(memory_order_relaxed);
+        return pushed > popped ? pushed - popped : 0;
+    }
+};
+
+const size_t POOL_CAPACITY = 1024;
+const size_t POOL_HIGH_WATERMARK = 256;                      // Producers stop when every pool holds this many
+const size_t POOL_LOW_WATERMARK = 64;                        // and start again when one falls below this
+const uint64_t POOL_GENERATE_NANOS = 100000000;              // A seed that takes longer is skipped
+
+struct PooledPuzzle
+{
+    long long level;                                         // GENERATED_LEVELS + seed
+    unsigned char cells[81];
+};
+
+class PuzzlePool
+{
+    MpmcQueue<PooledPuzzle, POOL_CAPACITY> pools[3];         // [difficulty]
+    atomic<bool> idle;                                       // Producers asleep, every pool was full
+    mutex idleLock;
+    condition_variable refill;
+    int producers;
+
+    int neediest() const                                     // Emptiest pool below the high watermark, -1 if none
+    {
+        int best = -1;
+        for (int d = 0; d < 3; ++d)
+            if (pools[d].size() < POOL_HIGH_WATERMARK && (best < 0 || pools[d].size() < pools[best].size()))
+                best = d;
+        return best;
+    }
+
+    bool anyBelowLow() const
+    {
+        for (const auto& pool : pools)
+            if (pool.size() < POOL_LOW_WATERMARK)
+                return true;
+        return false;
+    }
+
+    void produce(Rng rng)
+    {
+#ifdef __linux__
+        setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), 10);   // Background work, games get the CPU first
+#endif
+        while (true)
+        {
+            int d = neediest();
+            if (d < 0)
+            {
+                unique_lock<mutex> lock(idleLock);
+                idle.store(true);
+                refill.wait(lock, [&] { return !idle.load() || anyBelowLow(); });
+                idle.store(false);
+                continue;
+            }
+            PooledPuzzle puzzle;
+            puzzle.level = GENERATED_LEVELS + 1 + (long long)(rng.next() >> 17);   // 47 bits of seed
+            SolveStatus status;
+            if (generatePuzzle(puzzle.level - GENERATED_LEVELS, d, puzzle.cells, Deadline::after(POOL_GENERATE_NANOS), &status) != d ||
+                status != SOLVE_COMPLETE)
+                continue;                                    // Easier than asked, or a slow seed: try another
+            if (pools[d].push(puzzle))
+                countEvent(d, COUNT_POOL_GENERATED);
+        }
+    }
+public:
+    PuzzlePool() : idle(false), producers(0) {};
+
+    void start(int threads, uint64_t seed)                   // Adds producers up to threads, never removes any
+    {
+        lock_guard<mutex> guard(idleLock);
+        for (; producers < threads; ++producers)
+            thread(&PuzzlePool::produce, this, Rng::stream(seed, producers)).detach();
+    }
+
+    bool pop(int difficulty, PooledPuzzle& puzzle)           // false - pool starved, nothing ready
+    {
+        bool got = pools[difficulty].pop(puzzle);
+        if (!got)
+            countEvent(difficulty, COUNT_POOL_STARVED);
+        if (idle.load(memory_order_relaxed) && pools[difficulty].size() < POOL_LOW_WATERMARK)
+        {
+            lock_guard<mutex> guard(idleLock);               // Below the low watermark: wake the producers
+            idle.store(false);
+            refill.notify_all();
+        }
+        return got;
+    }
+
+    size_t depth(int difficulty) const { return pools[difficulty].size(); }
+};
+
+PuzzlePool& puzzlePool()
+{
+    static PuzzlePool* pool = new PuzzlePool();              // Never deleted, detached producers outlive main()
+    return *pool;
+}
+
+size_t puzzlePoolDepth(int difficulty)
+{
+    return puzzlePool().depth(difficulty);
+}
+
+class Generated : public Sudoku                              // A pooled puzzle, or one regenerated from its level id
+{
+    bool started;
+public:
+    Generated(int diff, long long lvl) : Sudoku(diff, lvl), started(false) {}
+
+    void start(const unsigned char* cells, const Variant& rules = classicVariant())   // The puzzle as it came out of the pool
+    {
+        variant = &rules;
+        memcpy(current, cells, 81);
+        startFromCurrent();
+        started = true;
+    }
+
+    const unsigned char* getSudoku()
+    {
+        if (!started)                                        // Resumed or replayed: the seed gives the same puzzle
+            generatePuzzle(level - GENERATED_LEVELS, difficulty, current);
+        else
+            for (int p = 0; p < 81; ++p)                     // Back to the clues
+                if (!isOriginalCell(p / 9, p % 9))
+                    current[p] = 0;
+        startFromCurrent();
+        started = true;
+        return current;
+    }
+};
+
+static_assert(sizeof(Generated) <= 256, "A game must stay within 256 bytes");
+
+Sudoku* newPooledGame(int difficulty)                        // Never waits: a starved pool gives a random derived level
+{
+    PooledPuzzle puzzle;
+    if (!puzzlePool().pop(difficulty, puzzle))
+    {
+        thread_local Rng rng(nowNanos());
+        long long lvl = 1 + (long long)(rng.next() % (uint64_t)MAX_LEVEL);
+        Sudoku* game = (difficulty == EASY) ? (Sudoku*)new Easy(lvl) : (difficulty == MEDIUM) ? (Sudoku*)new Medium(lvl) : new Hard(lvl);
+        game->getSudoku();
+        return game;
+    }
+    Generated* game = new Generated(difficulty, puzzle.level);
+    game->start(puzzle.cells);
+    return game;
+}
+
+// ---------------- PUZZLE PARSER --------------------------
+// Streaming parser for the usual interchange formats:
+//   lines (.txt, .sdm)  one puzzle per line, 81 cells, '0' or '.' for blanks, anything after a space is ignored
+//   grids (.txt)        9 rows of 9 cells with a blank between cells, as in the game's own easy.txt
+//   .sdk                9 rows of 9 cells per puzzle, '#' comments and "[Puzzle]" headers skipped
+// Lines holding only blanks count as empty.
+// Input can arrive in chunks of any size; parse() returns how many bytes it used and the
+// caller passes the rest again with the next chunk. Malformed input stops the parse and
+// getError() names the line and column. Cells are validated and converted 16 at a time with SSE2.
+// "#variant" lines (see VARIANTS) switch the rules for the puzzles that follow.
+enum PuzzleFormat { FORMAT_LINES, FORMAT_SDK };
+
+PuzzleFormat formatForPath(const string& path)
+{
+    size_t dot = path.rfind('.');
+    string ext = (dot == string::npos) ? "" : path.substr(dot);
+    return (ext == ".sdk" || ext == ".SDK") ? FORMAT_SDK : FORMAT_LINES;
+}
+
+int convertCells(const char* in, unsigned char* out, int count)   // Index of the first bad character, -1 if all are 0-9 or '.'
+{
+    int i = 0;
+#ifdef __SSE2__
+    const __m128i dot = _mm_set1_epi8('.');
+    const __m128i zero = _mm_set1_epi8('0');
+    const __m128i nine = _mm_set1_epi8(9);
+    for (; i + 16 <= count; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)(in + i));
+        __m128i isDot = _mm_cmpeq_epi8(v, dot);
+        v = _mm_or_si128(_mm_andnot_si128(isDot, v), _mm_and_si128(isDot, zero));   // '.' becomes '0'
+        __m128i digits = _mm_sub_epi8(v, zero);
+        __m128i valid = _mm_cmpeq_epi8(_mm_max_epu8(digits, nine), nine);           // Unsigned digits <= 9
+        int mask = _mm_movemask_epi8(valid);
+        if (mask != 0xFFFF)
+            return i + __builtin_ctz(~mask);
+        _mm_storeu_si128((__m128i*)(out + i), digits);
+    }
+#endif
+    for (; i < count; ++i)
+    {
+        char c = in[i];
+        if (c == '.')
+            c = '0';
+        if (c < '0' || c > '9')
+            return i;
+        out[i] = (unsigned char)(c - '0');
+    }
+    return -1;
+}
+
+class PuzzleParser
+{
+    PuzzleFormat format;
+    long long line;                                          // Number of the line being parsed, 1-based
+    int sdkRows;                                             // Rows of the current .sdk or grid puzzle read so far
+    unsigned char cells[81];
+    const Variant* variant;                                  // Rules of the puzzles being read
+    deque<Variant> declared;                                 // Every #variant seen, kept so references stay valid
+    string error;
+    bool sinkStopped;
+
+    bool fail(long long atLine, int column, const string& message)
+    {
+        error = "line " + to_string(atLine) + (column > 0 ? ", column " + to_string(column) : string()) + ": " + message;
+        return false;
+    }
+
+    bool readCells(const char* text, size_t len, int count, unsigned char* out)
+    {
+        if (len < (size_t)count)
+            return fail(line, (int)len + 1, "expected " + to_string(count) + " cells, found " + to_string(len));
+        if (len > (size_t)count && text[count] != ' ' && text[count] != '\t' && text[count] != ';' && text[count] != ',')
+            return fail(line, count + 1, "expected " + to_string(count) + " cells, line is longer");
+        int bad = convertCells(text, out, count);
+        if (bad >= 0)
+            return fail(line, bad + 1, string("unexpected character '") + text[bad] + "'");
+        return true;
+    }
+
+    bool readSpacedRow(const char* text, size_t len, unsigned char* out)   // "0 8 0 0 6 0 3 4 0"
+    {
+        char row[9];
+        for (int i = 0; i < 9; ++i)
+        {
+            size_t at = (size_t)i * 2;
+            if (at >= len)
+                return fail(line, (int)len + 1, "expected 9 cells, found " + to_string(i));
+            if (i > 0 && text[at - 1] != ' ' && text[at - 1] != '\t')
+                return fail(line, (int)at, "expected a blank between cells");
+            row[i] = text[at];
+        }
+        for (size_t at = 17; at < len; ++at)
+            if (text[at] != ' ' && text[at] != '\t')
+                return fail(line, (int)at + 1, "expected 9 cells, line is longer");
+        int bad = convertCells(row, out, 9);
+        if (bad >= 0)
+            return fail(line, bad * 2 + 1, string("unexpected character '") + row[bad] + "'");
+        return true;
+    }
+
+    template <typename Sink>
+    bool parseLine(const char* text, size_t len, Sink& sink)   // false - error or the sink asked to stop
+    {
+        if (len > 0 && text[len - 1] == '\r')
+            --len;
+        if (len >= 8 && memcmp(text, "#variant", 8) == 0)
+        {
+            if (sdkRows != 0)
+                return fail(line, 1, "#variant inside a puzzle");
+            string message;
+            declared.emplace_back();
+            if (!parseVariant(string(text + 8, len - 8), declared.back(), message))
+                return fail(line, 0, message);
+            variant = &declared.back();
+            return true;
+        }
+        while (len > 0 && (text[len - 1] == ' ' || text[len - 1] == '\t'))
+            --len;
+        if (len == 0 || text[0] == '#' || (format == FORMAT_SDK && text[0] == '['))
+            return true;
+        bool spaced = len >= 2 && (text[1] == ' ' || text[1] == '\t');   // A grid row, never the start of 81 cells
+        if (format == FORMAT_LINES && !spaced)
+        {
+            if (sdkRows != 0)
+                return fail(line, 1, "puzzle has only " + to_string(sdkRows) + " of 9 rows");
+            return readCells(text, len, 81, cells) && sink(cells, line, *variant);
+        }
+
+        if (!(spaced ? readSpacedRow(text, len, cells + sdkRows * 9) : readCells(text, len, 9, cells + sdkRows * 9)))
+            return false;
+        if (++sdkRows < 9)
+            return true;
+        sdkRows = 0;
+        return sink(cells, line - 8, *variant);
+    }
+public:
+    PuzzleParser(PuzzleFormat f) : format(f), line(1), sdkRows(0), variant(&classicVariant()), sinkStopped(false) {};
+
+    const string& getError() const { return error; }
+    bool failed() const { return !error.empty(); }
+    bool stopped() const { return sinkStopped; }             // The sink returned false, nothing more to parse
+
+    // Calls sink(const unsigned char* cells, long long firstLine, const Variant&) for every puzzle; the sink
+    // returns false to stop. Returns the bytes consumed, which is less than size when the
+    // last line is incomplete (and endOfInput is false), on error, or when the sink stops;
+    // failed() and stopped() tell the last two apart.
+    template <typename Sink>
+    size_t parse(const char* data, size_t size, bool endOfInput, Sink&& sink)
+    {
+        size_t pos = 0;
+        while (pos < size)
+        {
+            const char* newline = (const char*)memchr(data + pos, '\n', size - pos);
+            if (newline == nullptr && !endOfInput)
+                break;                                       // Wait for the rest of this line
+            size_t end = (newline != nullptr) ? newline - data : size;
+            if (!parseLine(data + pos, end - pos, sink))
+            {
+                sinkStopped = !failed();
+                return pos;
+            }
+            pos = (newline != nullptr) ? end + 1 : size;
+            ++line;
+        }
+        if (endOfInput && pos == size && sdkRows != 0)
+            fail(line, 0, "puzzle has only " + to_string(sdkRows) + " of 9 rows");
+        return pos;
+    }
+};
+
+// ---------------- PUZZLE INGESTION -----------------------
+// Reads puzzle files of any size in 4 MB aligned chunks through two buffers: while one chunk
+// is parsed (and its puzzles solved) the kernel fills the other. Reads go through io_uring when
+// the kernel allows it and fall back to plain pread otherwise. Memory use is fixed at two
+// buffers whatever the file size. Each buffer keeps room in front of its chunk for the
+// incomplete last line of the previous chunk, so the parser always sees whole lines.
+#ifdef __linux__
+const size_t INGEST_CHUNK_BYTES = 4 << 20;
+const size_t INGEST_CARRY_BYTES = 64 << 10;                  // Longest line that can span two chunks
+
+class UringReader                                            // Minimal io_uring ring for reads, no liburing needed
+{
+    int ringFd;
+    unsigned *sqTail, *sqMask, *sqArray;
+    unsigned *cqHead, *cqTail, *cqMask;
+    io_uring_sqe* sqes;
+    io_uring_cqe* cqes;
+    void* sqRing;
+    void* cqRing;
+    size_t sqRingBytes, cqRingBytes, sqeBytes;
+public:
+    UringReader() : ringFd(-1), sqes((io_uring_sqe*)MAP_FAILED), sqRing(MAP_FAILED), cqRing(MAP_FAILED) {};
+    ~UringReader()
+    {
+        if (sqes != MAP_FAILED) munmap(sqes, sqeBytes);
+        if (cqRing != MAP_FAILED && cqRing != sqRing) munmap(cqRing, cqRingBytes);
+        if (sqRing != MAP_FAILED) munmap(sqRing, sqRingBytes);
+        if (ringFd >= 0) close(ringFd);
+    }
+
+    bool setup(unsigned entries)                             // false - io_uring unavailable (old kernel, seccomp)
+    {
+        io_uring_params params{};
+        ringFd = (int)syscall(__NR_io_uring_setup, entries, &params);
+        if (ringFd < 0)
+            return false;
+        sqRingBytes = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqRingBytes = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool singleMap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (singleMap)
+            sqRingBytes = cqRingBytes = max(sqRingBytes, cqRingBytes);
+        sqRing = mmap(nullptr, sqRingBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+        if (sqRing == MAP_FAILED)
+            return false;
+        cqRing = singleMap ? sqRing : mmap(nullptr, cqRingBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+        if (cqRing == MAP_FAILED)
+            return false;
+        sqeBytes = params.sq_entries * sizeof(io_uring_sqe);
+        sqes = (io_uring_sqe*)mmap(nullptr, sqeBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+        if (sqes == MAP_FAILED)
+            return false;
+
+        char* sq = (char*)sqRing;
+        char* cq = (char*)cqRing;
+        sqTail = (unsigned*)(sq + params.sq_off.tail);
+        sqMask = (unsigned*)(sq + params.sq_off.ring_mask);
+        sqArray = (unsigned*)(sq + params.sq_off.array);
+        cqHead = (unsigned*)(cq + params.cq_off.head);
+        cqTail = (unsigned*)(cq + params.cq_off.tail);
+        cqMask = (unsigned*)(cq + params.cq_off.ring_mask);
+        cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+        return true;
+    }
+
+    bool submitRead(int fd, char* buffer, unsigned size, off_t offset, uint64_t tag)
+    {
+        unsigned tail = *sqTail;
+        unsigned index = tail & *sqMask;
+        io_uring_sqe* sqe = &sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = fd;
+        sqe->addr = (uint64_t)buffer;
+        sqe->len = size;
+        sqe->off = offset;
+        sqe->user_data = tag;
+        sqArray[index] = index;
+        __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+        return syscall(__NR_io_uring_enter, ringFd, 1, 0, 0, nullptr, 0) == 1;
+    }
+
+    bool waitCompletion(uint64_t& tag, int& result)
+    {
+        while (true)
+        {
+            unsigned head = *cqHead;
+            if (head != __atomic_load_n(cqTail, __ATOMIC_ACQUIRE))
+            {
+                io_uring_cqe* cqe = &cqes[head & *cqMask];
+                tag = cqe->user_data;
+                result = cqe->res;
+                __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+                return true;
+            }
+            if (syscall(__NR_io_uring_enter, ringFd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) < 0 && errno != EINTR)
+                return false;
+        }
+    }
+};
+
+class ChunkReader                                            // Two buffers in flight, handed out in file order
+{
+    int fd;
+    off_t fileSize;
+    off_t nextOffset;
+    off_t offsets[2];                                        // File offset of each buffer's chunk
+    char* buffers[2];
+    ssize_t results[2];                                      // Bytes read, -2 while the read is in flight
+    size_t filled[2];                                        // ...bytes of the chunk already in the buffer
+    UringReader uring;
+    bool usingUring;
+
+    bool chunkDone(int b) const { return filled[b] == INGEST_CHUNK_BYTES || offsets[b] + (off_t)filled[b] >= fileSize; }
+
+    bool readMore(int b)                                     // Reads may come back short: ask again for the rest of
+    {                                                        // the chunk until it is full, or the file ends
+        if (usingUring)
+        {
+            results[b] = -2;
+            return uring.submitRead(fd, buffers[b] + INGEST_CARRY_BYTES + filled[b], (unsigned)(INGEST_CHUNK_BYTES - filled[b]),
+                                    offsets[b] + filled[b], b);
+        }
+        while (!chunkDone(b))
+        {
+            ssize_t got = pread(fd, buffers[b] + INGEST_CARRY_BYTES + filled[b], INGEST_CHUNK_BYTES - filled[b], offsets[b] + filled[b]);
+            if (got < 0 && errno == EINTR)
+                continue;
+            if (got < 0)
+                return false;
+            if (got == 0)
+                break;                                       // File shrank since open()
+            filled[b] += got;
+        }
+        results[b] = filled[b];
+        return true;
+    }
+
+    bool startRead(int b)
+    {
+        offsets[b] = nextOffset;
+        filled[b] = 0;
+        if (nextOffset >= fileSize)
+        {
+            results[b] = 0;
+            return true;
+        }
+        nextOffset += INGEST_CHUNK_BYTES;
+        return readMore(b);
+    }
+public:
+    ChunkReader() : fd(-1), fileSize(0), nextOffset(0), offsets{0, 0}, buffers{nullptr, nullptr}, results{0, 0}, filled{0, 0},
+                    usingUring(false) {};
+    ~ChunkReader()
+    {
+        free(buffers[0]);
+        free(buffers[1]);
+        if (fd >= 0) close(fd);
+    }
+
+    bool open(const string& path)
+    {
+        fd = ::open(path.c_str(), O_RDONLY | O_DIRECT);      // Skip the page cache for big sequential scans
+        if (fd < 0)
+            fd = ::open(path.c_str(), O_RDONLY);             // Filesystem without O_DIRECT (tmpfs)
+        struct stat info;
+        if (fd < 0 || fstat(fd, &info) != 0)
+            return false;
+        fileSize = info.st_size;
+        for (char*& buffer : buffers)
+            if (posix_memalign((void**)&buffer, 4096, INGEST_CARRY_BYTES + INGEST_CHUNK_BYTES) != 0)
+                return false;
+        usingUring = uring.setup(4);
+        return startRead(0) && startRead(1);
+    }
+
+    bool usesUring() const { return usingUring; }
+    char* buffer(int b) { return buffers[b]; }
+
+    ssize_t wait(int b)                                      // Bytes in buffer b's chunk, 0 at end of file, -1 on error
+    {
+        while (results[b] == -2)
+        {
+            uint64_t tag;
+            int result;
+            if (!uring.waitCompletion(tag, result))
+                return -1;
+            if (result == -EINTR || result == -EAGAIN)
+                result = 0;                                  // Nothing read, ask again below
+            else if (result < 0)
+            {
+                results[tag] = -1;
+                continue;
+            }
+            else if (result == 0)
+            {
+                results[tag] = filled[tag];                  // File shrank since open()
+                continue;
+            }
+            filled[tag] += result;
+            if (chunkDone((int)tag))
+                results[tag] = filled[tag];
+            else if (!readMore((int)tag))
+                return -1;
+        }
+        return results[b];
+    }
+
+    bool release(int b) { return startRead(b); }             // Chunk parsed, reuse the buffer for the next one
+    bool atEnd(int b, ssize_t size) const { return offsets[b] + size >= fileSize || size < (ssize_t)INGEST_CHUNK_BYTES; }
+};
+
+// Calls sink(const unsigned char* cells, long long line, const Variant&) for every puzzle in the file.
+template <typename Sink>
+bool ingestPuzzleFile(const string& path, Sink&& sink, string& error, bool* usedUring = nullptr)
+{
+    ChunkReader reader;
+    if (!reader.open(path))
+    {
+        error = "cannot open " + path;
+        return false;
+    }
+    if (usedUring != nullptr)
+        *usedUring = reader.usesUring();
+
+    PuzzleParser parser(formatForPath(path));
+    size_t carry = 0;                                        // Bytes of an incomplete line in front of the chunk
+    for (int b = 0; ; b ^= 1)
+    {
+        ssize_t size = reader.wait(b);
+        if (size < 0)
+        {
+            error = "read failed on " + path;
+            return false;
+        }
+        bool end = reader.atEnd(b, size);
+        char* data = reader.buffer(b) + INGEST_CARRY_BYTES - carry;
+        size_t total = carry + size;
+        size_t used = parser.parse(data, total, end, sink);
+        if (parser.failed())
+        {
+            error = parser.getError();
+            return false;
+        }
+        if (end || parser.stopped())
+            return true;
+        carry = total - used;
+        if (carry > INGEST_CARRY_BYTES)
+        {
+            error = "line longer than " + to_string(INGEST_CARRY_BYTES) + " bytes";
+            return false;
+        }
+        memcpy(reader.buffer(b ^ 1) + INGEST_CARRY_BYTES - carry, data + used, carry);   // Kernel only writes after the carry area
+        if (!reader.release(b))
+        {
+            error = "read failed on " + path;
+            return false;
+        }
+    }
+}
+#endif
+
+// Calls sink(const unsigned char* cells, long long line, const Variant&) for every puzzle in the file, on any platform.
+template <typename Sink>
+bool forEachPuzzle(const string& path, Sink&& sink, string& error)
+{
+#ifdef __linux__
+    return ingestPuzzleFile(path, sink, error);
+#else
+    ifstream file(path, ios::binary);
+    if (!file)
+    {
+        error = "cannot open " + path;
+        return false;
+    }
+    PuzzleParser parser(formatForPath(path));
+    vector<char> buffer(1 << 20);
+    size_t kept = 0;                                         // Unparsed tail carried to the next chunk
+    while (true)
+    {
+        file.read(buffer.data() + kept, buffer.size() - kept);
+        size_t size = kept + file.gcount();
+        bool end = file.gcount() == 0 || file.eof();
+        size_t used = parser.parse(buffer.data(), size, end, sink);
+        if (parser.failed())
+        {
+            error = parser.getError();
+            return false;
+        }
+        if (end || parser.stopped())
+            return true;
+        kept = size - used;
+        memmove(buffer.data(), buffer.data() + used, kept);
+        if (kept == buffer.size())
+            buffer.resize(buffer.size() * 2);                // A single line bigger than the buffer
+    }
+#endif
+}
+
+// ---------------- BATCH OUTPUT ---------------------------
+// Result records for batch tools, as newline-delimited JSON or CSV. Every worker thread formats
+// into its own 1 MB BatchBuffer with hand-written number and cell formatting (no streams, no
+// allocation), and hands whole buffers to the shared BatchOutput, which does one large write
+// under a lock. Records from different threads interleave; the line field gives the input order.
+enum OutputFormat { OUTPUT_NDJSON, OUTPUT_CSV };
+
+struct SolveRecord
+{
+    long long line;                                          // First input line of the puzzle
+    const unsigned char* puzzle;
+    const unsigned char* solution;                           // nullptr when there is none
+    int solutions;                                           // 0, 1, or 2 for "more than one"
+    const char* rating;
+    uint64_t solveNanos;
+    long long nodes;
+};
+
+class BatchOutput
+{
+    FILE* file;
+    OutputFormat format;
+    mutex writeLock;
+    bool ok;
+public:
+    BatchOutput(FILE* f, OutputFormat fmt) : file(f), format(fmt), ok(true)
+    {
+        setvbuf(file, nullptr, _IONBF, 0);                   // Buffers arrive whole, stdio buffering would only copy them
+        if (format == OUTPUT_CSV)
+        {
+            const char* header = "line,puzzle,solution,solutions,rating,solve_ns,nodes\n";
+            write(header, strlen(header));
+        }
+    }
+
+    OutputFormat getFormat() const { return format; }
+    bool good() const { return ok; }
+
+    void write(const char* data, size_t size)
+    {
+        lock_guard<mutex> guard(writeLock);
+        ok = fwrite(data, 1, size, file) == size && ok;
+    }
+};
+
+class BatchBuffer
+{
+    static const size_t BYTES = 1 << 20;
+    static const size_t MAX_RECORD = 512;                    // Longest record, with room to spare
+    BatchOutput& output;
+    char* data;
+    size_t used;
+
+    static char* putNumber(char* p, unsigned long long value)
+    {
+        char digits[20];
+        int n = 0;
+        do
+        {
+            digits[n++] = char('0' + value % 10);
+            value /= 10;
+        } while (value != 0);
+        while (n > 0)
+            *p++ = digits[--n];
+        return p;
+    }
+    static char* putText(char* p, const char* text)
+    {
+        while (*text != '\0')
+            *p++ = *text++;
+        return p;
+    }
+    static char* putCells(char* p, const unsigned char* cells, char blank)
+    {
+        for (int i = 0; i < 81; ++i)
+            p[i] = cells[i] == 0 ? blank : char('0' + cells[i]);
+        return p + 81;
+    }
+public:
+    BatchBuffer(BatchOutput& out) : output(out), data(new char[BYTES]), used(0) {};
+    ~BatchBuffer()
+    {
+        flush();
+        delete[] data;
+    }
+
+    void add(const SolveRecord& r)
+    {
+        if (used + MAX_RECORD > BYTES)
+            flush();
+        char* p = data + used;
+        if (output.getFormat() == OUTPUT_NDJSON)
+        {
+            p = putNumber(putText(p, "{\"line\":"), r.line);
+            p = putCells(putText(p, ",\"puzzle\":\""), r.puzzle, '.');
+            if (r.solution != nullptr)
+                p = putText(putCells(putText(p, "\",\"solution\":\""), r.solution, '.'), "\"");
+            else
+                p = putText(p, "\",\"solution\":null");
+            p = putNumber(putText(p, ",\"solutions\":"), r.solutions);
+            p = putText(putText(putText(p, ",\"rating\":\""), r.rating), "\"");
+            p = putNumber(putText(p, ",\"solve_ns\":"), r.solveNanos);
+            p = putText(putNumber(putText(p, ",\"nodes\":"), r.nodes), "}\n");
+        }
+        else
+        {
+            p = putCells(putText(putNumber(p, r.line), ","), r.puzzle, '.');
+            *p++ = ',';
+            if (r.solution != nullptr)
+                p = putCells(p, r.solution, '.');
+            p = putText(putNumber(putText(p, ","), r.solutions), ",");
+            p = putText(putText(p, r.rating), ",");
+            p = putText(putNumber(putText(putNumber(p, r.solveNanos), ","), r.nodes), "\n");
+        }
+        used = p - data;
+    }
+
+    void flush()
+    {
+        if (used > 0)
+            output.write(data, used);
+        used = 0;
+    }
+};
+
+// ---------------- SAMURAI --------------------------------
+// Five 9x9 grids on a 21x21 board: four corner grids each share one corner box with the
+// center grid. SamuraiLayout numbers the 369 cells with the center grid first (0-80) and lists
+// the units of every cell, so searchBoard handles the whole board as one grid: a cell of a
+// shared box is in the row and column of both its grids, and clues anywhere narrow the center.
+// Only the center is searched. Once it is filled, the corner grids no longer depend on each
+// other, and each is finished by solveBoard - one after the other, or on GridWorkers at once.
+// Puzzle files hold five lines of 81 cells per puzzle, grids in the order TL, TR, C, BL, BR.
+const int SAMURAI_GRIDS = 5;
+const int SAMURAI_CENTER = 2;
+const int SAMURAI_ROW[SAMURAI_GRIDS] = {0, 0, 6, 12, 12};   // Top left corner of each grid on the board
+const int SAMURAI_COL[SAMURAI_GRIDS] = {0, 12, 6, 0, 12};
+const int SAMURAI_OUTER[4] = {0, 1, 3, 4};
+
+struct SamuraiLayout
+{
+    static const int CELLS = 369, UNITS = 131, SEARCH_CELLS = 81, SIDE = 21;   // 5 x 27 units, 4 boxes shared
+    short cellAt[SAMURAI_GRIDS][81];                         // Board cell of each grid position
+    short boardCell[SIDE * SIDE];                            // Cell at row * 21 + col, -1 in the gaps
+    unsigned char cellUnitCount[CELLS];                      // 3, or 5 in a shared box
+    unsigned char cellUnits[CELLS][5];                       // Row, column and box of the first grid, then row and column of the second
+};
+
+const SamuraiLayout& samuraiLayout()
+{
+    static const SamuraiLayout layout = []
+    {
+        SamuraiLayout s;
+        int boxUnit[49], cells = 0, units = SAMURAI_GRIDS * 18;   // Rows and columns first, then the 41 boxes
+        fill(begin(s.boardCell), end(s.boardCell), (short)-1);
+        fill(begin(boxUnit), end(boxUnit), -1);
+        const int order[SAMURAI_GRIDS] = {SAMURAI_CENTER, 0, 1, 3, 4};
+        for (int k : order)
+            for (int l = 0; l < 81; ++l)
+            {
+                int r = l / 9, c = l % 9, row = SAMURAI_ROW[k] + r, col = SAMURAI_COL[k] + c;
+                short& cell = s.boardCell[row * SamuraiLayout::SIDE + col];
+                int& box = boxUnit[row / 3 * 7 + col / 3];
+                if (box < 0)
+                    box = units++;
+                if (cell < 0)
+                {
+                    cell = (short)cells++;
+                    s.cellUnitCount[cell] = 0;
+                    s.cellUnits[cell][2] = (unsigned char)box;
+                }
+                unsigned char* u = s.cellUnits[cell];
+                u[s.cellUnitCount[cell]] = (unsigned char)(k * 18 + r);
+                u[s.cellUnitCount[cell] + 1] = (unsigned char)(k * 18 + 9 + c);
+                s.cellUnitCount[cell] += (s.cellUnitCount[cell] == 0) ? 3 : 2;
+                s.cellAt[k][l] = cell;
+            }
+        return s;
+    }();
+    return layout;
+}
+
+class GridWorkers                                            // Three threads kept for the life of the process, so a
+{                                                            // solve never pays for starting one (or a new metrics shard)
+    mutex runLock;                                           // One run at a time
+    mutex lock;
+    condition_variable wake, finished;
+    void (*task)(void*, int);
+    void* context;
+    uint64_t round;
+    int pending;
+
+    void work(int index)
+    {
+        uint64_t seen = 0;
+        unique_lock<mutex> guard(lock);
+        while (true)
+        {
+            wake.wait(guard, [&] { return round != seen; });
+            seen = round;
+            guard.unlock();
+            task(context, index);
+            guard.lock();
+            if (--pending == 0)
+                finished.notify_one();
+        }
+    }
+public:
+    static const int THREADS = 3;
+
+    GridWorkers() : task(nullptr), context(nullptr), round(0), pending(0)
+    {
+        for (int i = 1; i <= THREADS; ++i)
+            thread(&GridWorkers::work, this, i).detach();
+    }
+
+    template <typename Task>
+    void run(Task& t)                                        // Calls t(0) .. t(THREADS) at once, t(0) on this thread
+    {
+        lock_guard<mutex> serial(runLock);
+        unique_lock<mutex> guard(lock);
+        task = [](void* c, int i) { (*(Task*)c)(i); };
+        context = &t;
+        pending = THREADS;
+        ++round;
+        guard.unlock();
+        wake.notify_all();
+        t(0);
+        guard.lock();
+        finished.wait(guard, [&] { return pending == 0; });
+    }
+};
+
+GridWorkers& gridWorkers()
+{
+    static GridWorkers* workers = new GridWorkers();         // Never deleted, its threads are detached
+    return *workers;
+}
+
+struct SamuraiCorners                                        // searchBoard's completion step: solves the four corner grids
+{
+    const unsigned char* puzzle;
+    unsigned char* solution;                                 // nullptr - only count
+    int limit;
+    bool parallel;
+    bool filled;                                             // solution holds the first one found
+    const Deadline& deadline;
+    SolveStatus status;                                      // Set when a corner search ran out of time
+
+    int operator()(const unsigned char* cells)               // Solutions with this center, at most limit
+    {
+        const SamuraiLayout& s = samuraiLayout();
+        unsigned char grids[4][81], solved[4][81];
+        int counts[4];
+        SolveStatus statuses[4];
+        auto solveCorner = [&](int g)
+        {
+            const short* at = s.cellAt[SAMURAI_OUTER[g]];
+            for (int l = 0; l < 81; ++l)
+                grids[g][l] = (at[l] < SamuraiLayout::SEARCH_CELLS) ? cells[at[l]] : puzzle[at[l]];
+            counts[g] = solveBoard(grids[g], solved[g], limit, deadline, statuses[g]);
+        };
+        if (parallel)
+            gridWorkers().run(solveCorner);
+        else
+            for (int g = 0; g < 4; ++g)
+                solveCorner(g);
+        for (int g = 0; g < 4; ++g)
+            if (statuses[g] != SOLVE_COMPLETE)
+            {
+                status = statuses[g];
+                return 0;                                    // Unknown, the center search stops on its next check
+            }
+
+        long long product = 1;
+        for (int g = 0; g < 4; ++g)
+            product = min(product * counts[g], (long long)limit);
+        if (product > 0 && solution != nullptr && !filled)
+        {
+            memcpy(solution, cells, SamuraiLayout::SEARCH_CELLS);
+            for (int g = 0; g < 4; ++g)
+                for (int l = 0; l < 81; ++l)
+                    solution[s.cellAt[SAMURAI_OUTER[g]][l]] = solved[g][l];
+            filled = true;
+        }
+        return (int)product;
+    }
+};
+
+// Number of solutions found, at most limit. puzzle and solution hold the 369 board cells.
+int solveSamurai(const unsigned char* puzzle, unsigned char* solution = nullptr, int limit = 1, bool parallel = false,
+                 const Deadline& deadline = Deadline::none(), SolveStatus* status = nullptr)
+{
+    LatencyTimer timer(LATENCY_SOLVE);
+    bumpCounter(threadMetrics().solverRuns);
+    Bounded<NoTrace> bounded(deadline);
+    SamuraiCorners corners = {puzzle, solution, limit, parallel, false, deadline, SOLVE_COMPLETE};
+    int found = searchBoard<Bounded<NoTrace>, false>(puzzle, nullptr, limit, bounded, samuraiLayout(), corners);
+    if (status != nullptr)
+        *status = (corners.status != SOLVE_COMPLETE) ? corners.status : bounded.status;
+    return found;
+}
+
+// Calls sink(const unsigned char* cells, long long line) with the 369 cells of every puzzle in the file.
+template <typename Sink>
+bool forEachSamurai(const string& path, Sink&& sink, string& error)
+{
+    const SamuraiLayout& s = samuraiLayout();
+    unsigned char board[SamuraiLayout::CELLS];
+    int grid = 0;
+    long long firstLine = 0;
+    bool more = true;
+    bool ok = forEachPuzzle(path, [&](const unsigned char* cells, long long line, const Variant&)
+    {
+        if (grid == 0)
+        {
+            memset(board, 0, sizeof(board));
+            firstLine = line;
+        }
+        for (int l = 0; l < 81; ++l)
+            if (cells[l] != 0)
+                board[s.cellAt[grid][l]] = cells[l];        // Shared boxes are given twice, a clash makes it unsolvable anyway
+        if (++grid < SAMURAI_GRIDS)
+            return true;
+        grid = 0;
+        return more = sink((const unsigned char*)board, firstLine);
+    }, error);
+    if (ok && more && grid != 0)
+    {
+        error = "line " + to_string(firstLine) + ": puzzle has only " + to_string(grid) + " of 5 grids";
+        return false;
+    }
+    return ok;
+}
+
+struct SamuraiCatalog                                        // All 10 Samurai levels, loaded once
+{
+    unsigned char puzzles[10][SamuraiLayout::CELLS];
+};
+
+inline int cellAt(const SamuraiLayout& s, int row, int col) { return s.boardCell[row * SamuraiLayout::SIDE + col]; }
+inline bool cageAllows(const SamuraiLayout&, const unsigned char*, int, int) { return true; }   // No Killer cages on the board
+inline bool cagesAddUp(const SamuraiLayout&, const unsigned char*) { return true; }
+inline int unitsOf(const SamuraiLayout&) { return SamuraiLayout::UNITS; }
+
+class Samurai : public GridGame<SamuraiLayout>               // Same game rules as Sudoku, on the 21x21 board
+{
+    const unsigned char* original;                           // Points into the shared SamuraiCatalog
+    unsigned char level;
+public:
+    static const int SIDE = SamuraiLayout::SIDE;
+
+    Samurai(int lvl) : GridGame(&samuraiLayout()), original(nullptr), level((unsigned char)lvl) {};
+
+    const unsigned char* getSudoku()
+    {
+        static const SamuraiCatalog puzzles = []
+        {
+            SamuraiCatalog catalog = {};
+            int count = 0;
+            string error;
+            if (!forEachSamurai("samurai.txt", [&](const unsigned char* board, long long)
+                {
+                    memcpy(catalog.puzzles[count], board, SamuraiLayout::CELLS);
+                    return ++count < 10;
+                }, error))
+                cout << "samurai.txt: " << error << "\n";
+            return catalog;
+        }();
+        original = puzzles.puzzles[level - 1];
+        memcpy(current, original, sizeof(current));
+        startFromCurrent();
+        return current;
+    }
+
+    bool hasCell(int row, int col) const { return cellOf(row, col) >= 0; }
+
+    string getDifficulty() const { return "samurai"; }
+    int getDifficultyIndex() const { return HARD; }          // Counted with the hard games in the metrics
+    int getLevel() const { return level; }
+};
+
+// ---------------- SOLVER PORTFOLIO -----------------------
+// Different engines win on different puzzles, so the portfolio can race them:
+//   mrv        searchBoard(), bitmask backtracking on the most constrained cell
+//   dlx        Dancing Links exact cover (Knuth's Algorithm X), one row per cell and digit
+//   propagate  naked and hidden singles to a fixed point at every node, then a guess
+// With more than one core every engine runs on its own GridWorkers thread, the first answer
+// wins and the others are cancelled cooperatively through a CancelToken of the race, which
+// is a child of the caller's own deadline token.
+// On one core the portfolio runs a single engine, picked from what it has learned so far:
+// puzzles are bucketed by clue count and initial candidate density, and each bucket keeps a
+// running mean solve time per engine. Buckets try every engine a few times before trusting
+// the means, and keep re-trying the others now and then.
+// Only classic grids have all three engines; other variants always go to mrv.
+enum SolverEngine { ENGINE_MRV, ENGINE_DLX, ENGINE_PROPAGATE, ENGINES };
+const char* const ENGINE_NAMES[] = {"mrv", "dlx", "propagate"};
+
+bool classicClash(const unsigned char* puzzle)               // true - two clues share a row, column or box
+{
+    uint16_t rows[9] = {}, cols[9] = {}, boxes[9] = {};
+    for (int p = 0; p < 81; ++p)
+    {
+        int num = puzzle[p], r = p / 9, c = p % 9, b = r / 3 * 3 + c / 3;
+        if (num == 0)
+            continue;
+        if (((rows[r] | cols[c] | boxes[b]) >> num) & 1)
+            return true;
+        rows[r] |= 1 << num;
+        cols[c] |= 1 << num;
+        boxes[b] |= 1 << num;
+    }
+    return false;
+}
+
+class DancingLinks
+{
+    struct Node { int16_t left, right, up, down, column, row; };   // row - cell * 9 + digit - 1
+    static const int COLUMNS = 324;                          // Cell filled, row has digit, column has digit, box has digit
+
+    Node* nodes;                                             // 0 is the root, 1-324 the column headers
+    int16_t* size;
+    int16_t chosen[81];
+    unsigned char cells[81];
+    unsigned char* solution;
+    int limit, found;
+    Bounded<NoTrace> poll;
+
+    void cover(int c)
+    {
+        nodes[nodes[c].right].left = nodes[c].left;
+        nodes[nodes[c].left].right = nodes[c].right;
+        for (int i = nodes[c].down; i != c; i = nodes[i].down)
+            for (int j = nodes[i].right; j != i; j = nodes[j].right)
+            {
+                nodes[nodes[j].down].up = nodes[j].up;
+                nodes[nodes[j].up].down = nodes[j].down;
+                --size[nodes[j].column];
+            }
+    }
+
+    void uncover(int c)
+    {
+        for (int i = nodes[c].up; i != c; i = nodes[i].up)
+            for (int j = nodes[i].left; j != i; j = nodes[j].left)
+            {
+                ++size[nodes[j].column];
+                nodes[nodes[j].down].up = (int16_t)j;
+                nodes[nodes[j].up].down = (int16_t)j;
+            }
+        nodes[nodes[c].right].left = (int16_t)c;
+        nodes[nodes[c].left].right = (int16_t)c;
+    }
+
+    bool search(int depth)                                   // true - stop: limit reached or out of time
+    {
+        if (poll.cancelled())
+            return true;
+        if (nodes[0].right == 0)
+        {
+            if (found++ == 0 && solution != nullptr)
+            {
+                memcpy(solution, cells, 81);
+                for (int k = 0; k < depth; ++k)
+                    solution[chosen[k] / 9] = (unsigned char)(chosen[k] % 9 + 1);
+            }
+            return found >= limit;
+        }
+        int best = nodes[0].right;
+        for (int c = nodes[best].right; c != 0 && size[best] > 1; c = nodes[c].right)
+            if (size[c] < size[best])
+                best = c;
+        if (size[best] == 0)
+            return false;
+        cover(best);
+        bool done = false;
+        for (int i = nodes[best].down; i != best && !done; i = nodes[i].down)
+        {
+            chosen[depth] = nodes[i].row;
+            for (int j = nodes[i].right; j != i; j = nodes[j].right)
+                cover(nodes[j].column);
+            done = search(depth + 1);
+            for (int j = nodes[i].left; j != i; j = nodes[j].left)
+                uncover(nodes[j].column);
+        }
+        uncover(best);
+        return done;
+    }
+public:
+    DancingLinks(const Deadline& deadline) : poll(deadline) {};
+
+    SolveStatus status() const { return poll.status; }
+
+    int solve(const unsigned char* puzzle, unsigned char* out, int max)   // Number of solutions found, at most max
+    {
+        if (classicClash(puzzle))
+            return 0;
+        SearchArena::Mark arenaMark = searchArena.mark();
+        nodes = searchArena.allocateArray<Node>(1 + COLUMNS + 729 * 4);
+        size = searchArena.allocateArray<int16_t>(1 + COLUMNS);
+        memcpy(cells, puzzle, 81);
+        solution = out;
+        limit = max;
+        found = 0;
+
+        bool satisfied[1 + COLUMNS] = {};                    // Columns the clues already fill stay out of the matrix
+        for (int p = 0; p < 81; ++p)
+            if (puzzle[p] != 0)
+            {
+                int r = p / 9, c = p % 9, b = r / 3 * 3 + c / 3, d = puzzle[p] - 1;
+                satisfied[1 + p] = satisfied[82 + r * 9 + d] = satisfied[163 + c * 9 + d] = satisfied[244 + b * 9 + d] = true;
+            }
+        int last = 0;
+        for (int c = 1; c <= COLUMNS; ++c)
+        {
+            nodes[c] = {(int16_t)c, (int16_t)c, (int16_t)c, (int16_t)c, (int16_t)c, -1};
+            size[c] = 0;
+            if (satisfied[c])
+                continue;
+            nodes[c].left = (int16_t)last;
+            nodes[last].right = (int16_t)c;
+            last = c;
+        }
+        nodes[0].left = (int16_t)last;
+        nodes[last].right = 0;
+
+        int next = 1 + COLUMNS;
+        for (int p = 0; p < 81; ++p)
+        {
+            if (puzzle[p] != 0)
+                continue;
+            int r = p / 9, c = p % 9, b = r / 3 * 3 + c / 3;
+            for (int d = 0; d < 9; ++d)
+            {
+                int columns[4] = {1 + p, 82 + r * 9 + d, 163 + c * 9 + d, 244 + b * 9 + d};
+                if (satisfied[columns[1]] || satisfied[columns[2]] || satisfied[columns[3]])
+                    continue;                                // A clue already placed this digit there
+                for (int k = 0; k < 4; ++k)
+                {
+                    Node& n = nodes[next + k];
+                    int col = columns[k];
+                    n.column = (int16_t)col;
+                    n.row = (int16_t)(p * 9 + d);
+                    n.left = (int16_t)(next + (k + 3) % 4);
+                    n.right = (int16_t)(next + (k + 1) % 4);
+                    n.down = (int16_t)col;
+                    n.up = nodes[col].up;
+                    nodes[nodes[col].up].down = (int16_t)(next + k);
+                    nodes[col].up = (int16_t)(next + k);
+                    ++size[col];
+                }
+                next += 4;
+            }
+        }
+        search(0);
+        searchArena.rewind(arenaMark);
+        return found;
+    }
+};
+
+class PropagationSolver
+{
+    struct State
+    {
+        uint16_t candidates[81];                             // Bit n - digit n still possible, just the digit once placed
+        unsigned char cells[81];
+    };
+    unsigned char* solution;
+    int limit, found;
+    Bounded<NoTrace> poll;
+
+    static const unsigned char (&peers())[81][20]            // The 20 cells that share a unit with each cell
+    {
+        static unsigned char table[81][20];
+        static bool built = [] {
+            for (int p = 0; p < 81; ++p)
+            {
+                int n = 0, r = p / 9, c = p % 9;
+                for (int q = 0; q < 81; ++q)
+                    if (q != p && (q / 9 == r || q % 9 == c || (q / 27 == p / 27 && q % 9 / 3 == c / 3)))
+                        table[p][n++] = (unsigned char)q;
+            }
+            return true;
+        }();
+        (void)built;
+        return table;
+    }
+
+    static bool place(State& s, int p, int num)              // false - contradiction
+    {
+        if (!((s.candidates[p] >> num) & 1))
+            return false;
+        s.cells[p] = (unsigned char)num;
+        s.candidates[p] = (uint16_t)(1 << num);
+        for (int q : peers()[p])
+            if ((s.candidates[q] >> num) & 1)
+            {
+                s.candidates[q] &= (uint16_t)~(1 << num);
+                if (s.candidates[q] == 0)
+                    return false;
+                if (s.cells[q] == 0 && countBits(s.candidates[q]) == 1 && !place(s, q, __builtin_ctz(s.candidates[q])))
+                    return false;                            // Naked single
+            }
+        return true;
+    }
+
+    static bool hiddenSingles(State& s)                      // false - contradiction; repeats until nothing changes
+    {
+        const Variant& v = classicVariant();
+        for (bool changed = true; changed; )
+        {
+            changed = false;
+            for (int u = 0; u < 27; ++u)
+            {
+                int once = 0, twice = 0, placed = 0;
+                for (int i = 0; i < 9; ++i)
+                {
+                    int p = v.units[u][i];
+                    if (s.cells[p] != 0)
+                        placed |= 1 << s.cells[p];
+                    twice |= once & s.candidates[p];
+                    once |= s.candidates[p];
+                }
+                if ((once | placed) != 0x3FE)
+                    return false;                            // Some digit has no place left in this unit
+                int singles = once & ~twice & ~placed;
+                for (; singles != 0; singles &= singles - 1)
+                {
+                    int num = __builtin_ctz(singles);
+                    for (int i = 0; i < 9; ++i)
+                    {
+                        int p = v.units[u][i];
+                        if ((s.candidates[p] >> num) & 1)
+                        {
+                            if (s.cells[p] == 0)             // Not placed meanwhile by an earlier single
+                            {
+                                if (!place(s, p, num))
+                                    return false;
+                                changed = true;
+                            }
+                            break;
+                        }
+                    }
+                }
+            }
+        }
+        return true;
+    }
+
+    bool search(State& s)                                    // true - stop: limit reached or out of time
+    {
+        if (poll.cancelled())
+            return true;
+        if (!hiddenSingles(s))
+            return false;
+        int best = -1, bestCount = 10;
+        for (int p = 0; p < 81 && bestCount > 2; ++p)
+            if (s.cells[p] == 0 && countBits(s.candidates[p]) < bestCount)
+            {
+                best = p;
+                bestCount = countBits(s.candidates[p]);
+            }
+        if (best < 0)
+        {
+            if (found++ == 0 && solution != nullptr)
+                memcpy(solution, s.cells, 81);
+            return found >= limit;
+        }
+        for (int options = s.candidates[best]; options != 0; options &= options - 1)
+        {
+            State next = s;
+            if (place(next, best, __builtin_ctz(options)) && search(next))
+                return true;
+        }
+        return false;
+    }
+public:
+    PropagationSolver(const Deadline& deadline) : poll(deadline, DEADLINE_CHECK_NODES / 16) {};   // Nodes cost ~16x an MRV node
+
+    SolveStatus status() const { return poll.status; }
+
+    int solve(const unsigned char* puzzle, unsigned char* out, int max)   // Number of solutions found, at most max
+    {
+        if (classicClash(puzzle))
+            return 0;
+        solution = out;
+        limit = max;
+        found = 0;
+        State s;
+        memset(s.cells, 0, sizeof(s.cells));
+        for (uint16_t& c : s.candidates)
+            c = 0x3FE;
+        for (int p = 0; p < 81; ++p)
+            if (puzzle[p] != 0 && s.cells[p] != puzzle[p] && !place(s, p, puzzle[p]))
+                return 0;
+        search(s);
+        return found;
+    }
+};
+
+int solveWithEngine(int engine, const unsigned char* puzzle, unsigned char* solution, int limit, const Deadline& deadline,
+                    SolveStatus& status, const Variant& variant = classicVariant())   // Partial count if stopped early
+{
+    if (engine == ENGINE_DLX)
+    {
+        DancingLinks dlx(deadline);
+        int found = dlx.solve(puzzle, solution, limit);
+        status = dlx.status();
+        return found;
+    }
+    if (engine == ENGINE_PROPAGATE)
+    {
+        PropagationSolver propagate(deadline);
+        int found = propagate.solve(puzzle, solution, limit);
+        status = propagate.status();
+        return found;
+    }
+    return solveBoard(puzzle, solution, limit, deadline, status, variant);
+}
+
+struct PuzzleFeatures
+{
+    int clues;
+    double density;                                          // Candidates left over all empty cells / (9 * empty cells)
+
+    int bucket() const                                       // 4 x 4 buckets for the learned engine choice
+    {
+        int c = clues < 25 ? 0 : clues < 30 ? 1 : clues < 36 ? 2 : 3;
+        int d = density < 0.3 ? 0 : density < 0.4 ? 1 : density < 0.5 ? 2 : 3;
+        return c * 4 + d;
+    }
+};
+
+PuzzleFeatures puzzleFeatures(const unsigned char* puzzle)
+{
+    uint16_t rows[9] = {}, cols[9] = {}, boxes[9] = {};
+    PuzzleFeatures f = {0, 0};
+    for (int p = 0; p < 81; ++p)
+        if (puzzle[p] != 0)
+        {
+            int r = p / 9, c = p % 9;
+            rows[r] |= 1 << puzzle[p];
+            cols[c] |= 1 << puzzle[p];
+            boxes[r / 3 * 3 + c / 3] |= 1 << puzzle[p];
+            ++f.clues;
+        }
+    int candidates = 0;
+    for (int p = 0; p < 81; ++p)
+        if (puzzle[p] == 0)
+        {
+            int r = p / 9, c = p % 9;
+            candidates += countBits(~(rows[r] | cols[c] | boxes[r / 3 * 3 + c / 3]) & 0x3FE);
+        }
+    f.density = (f.clues == 81) ? 0 : candidates / (9.0 * (81 - f.clues));
+    return f;
+}
+
+class SolverPortfolio
+{
+    static const int BUCKETS = 16;
+    static const int WARMUP_RUNS = 4;                        // Per engine and bucket before the means count
+    static const int EXPLORE_EVERY = 32;
+
+    struct EngineRecord
+    {
+        atomic<uint64_t> runs;
+        atomic<uint64_t> meanNanos;                          // Moving average, the last 8 runs or so
+        atomic<uint64_t> wins;                               // Races this engine answered first
+    };
+    EngineRecord records[BUCKETS][ENGINES];
+    atomic<uint64_t> bucketRuns[BUCKETS];
+
+    void learn(int bucket, int engine, uint64_t nanos)       // Races between callers only blur the mean a little
+    {
+        EngineRecord& r = records[bucket][engine];
+        uint64_t runs = r.runs.load(memory_order_relaxed), mean = r.meanNanos.load(memory_order_relaxed);
+        r.meanNanos.store(runs == 0 ? nanos : mean + ((int64_t)nanos - (int64_t)mean) / 8, memory_order_relaxed);
+        r.runs.store(runs + 1, memory_order_relaxed);
+    }
+public:
+    SolverPortfolio()
+    {
+        for (int b = 0; b < BUCKETS; ++b)
+        {
+            bucketRuns[b].store(0, memory_order_relaxed);
+            for (EngineRecord& r : records[b])
+            {
+                r.runs.store(0, memory_order_relaxed);
+                r.meanNanos.store(0, memory_order_relaxed);
+                r.wins.store(0, memory_order_relaxed);
+            }
+        }
+    }
+
+    int pick(const PuzzleFeatures& features)                 // Engine to run alone on this puzzle
+    {
+        int b = features.bucket();
+        uint64_t n = bucketRuns[b].load(memory_order_relaxed);
+        bucketRuns[b].store(n + 1, memory_order_relaxed);
+        for (int e = 0; e < ENGINES; ++e)
+            if (records[b][e].runs.load(memory_order_relaxed) < WARMUP_RUNS)
+                return e;
+        if (n % EXPLORE_EVERY == 0)
+            return (int)(n / EXPLORE_EVERY % ENGINES);       // Now and then, so a stale mean can recover
+        int best = 0;
+        for (int e = 1; e < ENGINES; ++e)
+            if (records[b][e].meanNanos.load(memory_order_relaxed) < records[b][best].meanNanos.load(memory_order_relaxed))
+                best = e;
+        return best;
+    }
+
+    // Number of solutions found, at most limit. race - all engines at once (needs cores), otherwise the
+    // learned pick alone. engineUsed gets the engine whose answer this is; status says if the
+    // deadline cut it short, in which case the count is only what was found by then.
+    int solve(const unsigned char* puzzle, const Variant& variant, unsigned char* solution, int limit, bool race,
+              int* engineUsed = nullptr, const Deadline& deadline = Deadline::none(), SolveStatus* status = nullptr)
+    {
+        LatencyTimer timer(LATENCY_SOLVE);                   // One run whichever engines answer it
+        bumpCounter(threadMetrics().solverRuns);
+        SolveStatus ignored;
+        SolveStatus& result = (status != nullptr) ? *status : ignored;
+        if (strcmp(variant.name, "classic") != 0)            // Only mrv knows other units and cages
+        {
+            if (engineUsed != nullptr)
+                *engineUsed = ENGINE_MRV;
+            return solveWithEngine(ENGINE_MRV, puzzle, solution, limit, deadline, result, variant);
+        }
+        PuzzleFeatures features = puzzleFeatures(puzzle);
+        if (!race)
+        {
+            int engine = pick(features);
+            uint64_t start = nowNanos();
+            int found = solveWithEngine(engine, puzzle, solution, limit, deadline, result);
+            if (result == SOLVE_COMPLETE)
+                learn(features.bucket(), engine, nowNanos() - start);
+            if (engineUsed != nullptr)
+                *engineUsed = engine;
+            return found;
+        }
+
+        struct Race
+        {
+            const unsigned char* puzzle;
+            unsigned char* solution;
+            int limit;
+            CancelToken losers;                              // Tripped by the winner, or with the caller's token
+            Deadline deadline;
+            atomic<bool> answered;
+            int winner, found;
+            uint64_t start, nanos;
+
+            Race(const unsigned char* p, unsigned char* s, int l, const Deadline& d)
+                : puzzle(p), solution(s), limit(l), losers(d.token), deadline{d.atNanos, &losers}, answered(false),
+                  winner(-1), found(0), start(nowNanos()), nanos(0) {};
+
+            void operator()(int engine)
+            {
+                if (engine >= ENGINES)
+                    return;
+                unsigned char mine[81];
+                SolveStatus stopped;
+                int n = solveWithEngine(engine, puzzle, mine, limit, deadline, stopped);
+                if (stopped != SOLVE_COMPLETE || answered.exchange(true))
+                    return;                                  // Out of time, or someone answered first
+                losers.cancel();
+                winner = engine;
+                found = n;
+                nanos = nowNanos() - start;
+                if (n > 0 && solution != nullptr)
+                    memcpy(solution, mine, 81);
+            }
+        } r(puzzle, solution, limit, deadline);
+        static_assert(GridWorkers::THREADS + 1 >= ENGINES, "one thread per engine");
+        gridWorkers().run(r);                                // Returns once the losers noticed the token
+        if (r.winner < 0)
+        {
+            result = (deadline.token != nullptr && deadline.token->isCancelled()) ? SOLVE_CANCELLED : SOLVE_TIMEOUT;
+            return 0;
+        }
+        result = SOLVE_COMPLETE;
+        learn(features.bucket(), r.winner, r.nanos);
+        records[features.bucket()][r.winner].wins.fetch_add(1, memory_order_relaxed);
+        if (engineUsed != nullptr)
+            *engineUsed = r.winner;
+        return r.found;
+    }
+
+    int solve(const Sudoku& board, unsigned char* solution, int limit = 2,   // The board as it stands, raced when there are cores
+              const Deadline& deadline = Deadline::none(), SolveStatus* status = nullptr)
+    {
+        return solve(board.getCells(), board.getVariant(), solution, limit, thread::hardware_concurrency() > 1, nullptr, deadline, status);
+    }
+
+    void print(ostream& out) const
+    {
+        static const char* const CLUES[] = {"<25", "25-29", "30-35", "36+"};
+        static const char* const DENSITY[] = {"<0.3", "0.3-0.4", "0.4-0.5", "0.5+"};
+        for (int b = 0; b < BUCKETS; ++b)
+        {
+            if (bucketRuns[b].load() == 0 && records[b][0].wins.load() + records[b][1].wins.load() + records[b][2].wins.load() == 0)
+                continue;
+            out << "  clues " << CLUES[b / 4] << ", density " << DENSITY[b % 4] << ":";
+            for (int e = 0; e < ENGINES; ++e)
+                out << "  " << ENGINE_NAMES[e] << " " << records[b][e].meanNanos.load() / 1000.0 << " us x"
+                    << records[b][e].runs.load() << " (" << records[b][e].wins.load() << " wins)";
+            out << "\n";
+        }
+    }
+};
+
+SolverPortfolio& solverPortfolio()
+{
+    static SolverPortfolio* portfolio = new SolverPortfolio();   // Never deleted, like the GridWorkers it races on
+    return *portfolio;
+}
+
+// ---------------- DISPLAY FUNCTIONS ------------------------
+void displayCages(const Variant& v)                          // Killer: cage letters laid out like the board, then the sums
+{
+    cout << "\nCages:\n\n";
+    for (int i = 0; i < 9; ++i)
+    {
+        cout << "    ";
+        for (int j = 0; j < 9; ++j)
+        {
+            int cage = v.cageOf[i * 9 + j];
+            cout << ' ' << (cage == 0 ? '.' : CAGE_LETTERS[cage - 1]) << ' ';
+            if ((j + 1) % 3 == 0 && j != 8)
+                cout << ' ';
+        }
+        cout << "\n";
+    }
+    cout << "\n   ";
+    for (int c = 1; c <= v.cageCount; ++c)
+        cout << ' ' << CAGE_LETTERS[c - 1] << '=' << (int)v.cageSum[c] << ((c % 12 == 0) ? "\n   " : "");
+    cout << "\n";
+}
+
+void displayPencilMarks(const Sudoku* game)                  // Each cell as a 3x3 grid of its marks, filled cells as [n]
+{
+    const PencilMarks* marks = game->getPencilMarks();
+    cout << "\nPencil marks (" << (marks->isAutomatic() ? "auto" : "manual") << "):\n\n";
+    string header(41, ' ');
+    for (int j = 0; j < 9; ++j)
+        header[6 + j / 3 * 12 + j % 3 * 4] = char('1' + j);
+    cout << header << "\n";
+    const char* border = "    +-----------+-----------+-----------+\n";
+    for (int i = 0; i < 9; ++i)
+    {
+        cout << (i % 3 == 0 ? border : "    |           |           |           |\n");
+        for (int k = 0; k < 3; ++k)                          // Digits 1-3, 4-6, 7-9 of every cell in the row
+        {
+            if (k == 1)
+                printf("%2d  |", i + 1);
+            else
+                cout << "    |";
+            for (int j = 0; j < 9; ++j)
+            {
+                int p = i * 9 + j, num = game->getCell(i, j);
+                char text[4] = "   ";
+                if (num != 0 && k == 1)
+                    text[0] = '[', text[1] = char('0' + num), text[2] = ']';
+                else if (num == 0)
+                    for (int c = 0; c < 3; ++c)
+                        text[c] = ((marks->at(p) >> (k * 3 + c + 1)) & 1) ? char('1' + k * 3 + c) : '.';
+                cout << text << ((j % 3 == 2) ? "|" : " ");
+            }
+            cout << "\n";
+        }
+    }
+    cout << border;
+}
+
+void displayBoard(const unsigned char* board, Sudoku* game, int timeLeft, const CellSet& conflicts = CellSet())   // conflicts - cells
+{                                                                                                                 // drawn as *n*
+    LatencyTimer timer(LATENCY_RENDER);
+    bool clash = conflicts.any();
+    int minutes = timeLeft / 60;
+    int seconds = timeLeft % 60;
+
+    cout << "\nYour Sudoku Board:\n\n";
+    cout << "     1  2  3   4  5  6   7  8  9       STATS\n";
+    cout << "   +---------+---------+---------+     ---------------------------------------\n";
+
+    for (int i = 0; i < 9; ++i)
+    {
+        cout << i + 1 << "  |";
+        for (int j = 0; j < 9; ++j)
+        {
+            if (board[i * 9 + j] == 0)
+                cout << " . ";
+            else if (clash && conflicts.has(i * 9 + j))
+                cout << "*" << (int)board[i * 9 + j] << "*";
+            else
+                cout << " " << (int)board[i * 9 + j] << " ";
+            if ((j + 1) % 3 == 0 && j != 8)
+                cout << "|";
+        }
+        if ((i + 1) % 3 == 0 && i != 8)
+        {
+            if (i == 2)
+            {
+                cout << "|     \n";
+                cout << "   +---------+---------+---------+";
+                cout << "     Mistakes : " << game->getMistakeCount() << "/5";
+                printf("     Time Left : %02d:%02d\n", minutes, seconds);
+            }
+            else if (i == 5)
+            {
+                cout << "|     \n";
+                cout << "   +---------+---------+---------+     ---------------------------------------\n";
+            }
+            else
+            {
+                cout << "|     \n";
+                cout << "   +---------+---------+---------+     \n";
+            }
+        }
+        else
+        {
+            cout << "|";
+            if (i == 0) cout << "     Difficulty : " << game->getDifficulty() << "     Level : " << game->getLevel() << "\n";
+            else if (i == 1) cout << "     ---------------------------------------\n";
+            else if (i == 3) cout << "     Undo : -1 -1 -1\n";
+            else if (i == 4) cout << "     Exit : 0 0 0\n";
+            else if (i == 6) cout << "     Hint : -2 -2 -2\n";
+            else if (i == 7) cout << "     Pencil mark : row col -num     Auto marks : -3 -3 -3\n";
+            else if (i == 8) cout << "     Branch " << game->getBranch() << "/" << game->getBranchCount() << " : try one -4 -4 -4, go to one -4 -4 n\n";
+            else cout << "\n";
+        }
+    }
+    cout << "   +---------+---------+---------+\n";
+    if (clash)
+        cout << "   *n* : clashes with the number you entered\n";
+    if (game->getVariant().cageCount > 0)
+        displayCages(game->getVariant());
+    if (game->getPencilMarks() != nullptr)
+        displayPencilMarks(game);
+}
+
+void displayBoard(const unsigned char*, Samurai* game, int timeLeft)   // 21x21 board, gaps between the corner grids left blank
+{
+    LatencyTimer timer(LATENCY_RENDER);
+    auto hasBox = [&](int boxRow, int boxCol)                // 7x7 boxes on the board
+    {
+        return boxRow >= 0 && boxRow < 7 && boxCol >= 0 && boxCol < 7 && game->hasCell(boxRow * 3, boxCol * 3);
+    };
+    auto border = [&](int boxRow)                            // Line above box row boxRow
+    {
+        string line = "    ";
+        for (int bc = 0; bc < 7; ++bc)
+        {
+            bool edge = hasBox(boxRow - 1, bc) || hasBox(boxRow, bc);
+            bool before = bc > 0 && (hasBox(boxRow - 1, bc - 1) || hasBox(boxRow, bc - 1));
+            line += (edge || before) ? "+" : " ";
+            line += edge ? "---------" : "         ";
+        }
+        line += (hasBox(boxRow - 1, 6) || hasBox(boxRow, 6)) ? "+" : "";
+        cout << line << "\n";
+    };
+
+    cout << "\nYour Samurai Board:\n\n     ";
+    for (int j = 0; j < Samurai::SIDE; ++j)
+        printf("%2d %s", j + 1, (j % 3 == 2) ? " " : "");
+    cout << "\n";
+    for (int i = 0; i < Samurai::SIDE; ++i)
+    {
+        if (i % 3 == 0)
+            border(i / 3);
+        printf("%2d  ", i + 1);
+        for (int bc = 0; bc < 7; ++bc)
+        {
+            cout << ((hasBox(i / 3, bc) || hasBox(i / 3, bc - 1)) ? "|" : " ");
+            for (int j = bc * 3; j < bc * 3 + 3; ++j)
+            {
+                if (!game->hasCell(i, j))
+                    cout << "   ";
+                else if (game->getCell(i, j) == 0)
+                    cout << " . ";
+                else
+                    cout << " " << game->getCell(i, j) << " ";
+            }
+        }
+        cout << (hasBox(i / 3, 6) ? "|" : "") << "\n";
+    }
+    border(7);
+    cout << "\n     Difficulty : " << game->getDifficulty() << "     Level : " << game->getLevel() << "\n";
+    cout << "     Mistakes : " << game->getMistakeCount() << "/5";
+    printf("     Time Left : %02d:%02d\n", timeLeft / 60, timeLeft % 60);
+    cout << "     Undo : -1 -1 -1     Exit : 0 0 0\n";
+}
+
+void displayRules()
+{
+    cout << "\n=========== SUDOKU RULES ===========\n";
+    cout << "1. Fill each row with numbers 1-9 without repetition\n";
+    cout << "2. Fill each column with numbers 1-9 without repetition\n";
+    cout << "3. Fill each 3x3 box with numbers 1-9 without repetition\n";
+    cout << "4. You cannot change the given numbers (clues)\n";
+    cout << "5. Limited time based on difficulty:\n";
+    cout << "   - Easy: 15 mins | Medium: 13 mins | Hard: 11 mins | Samurai: 45 mins\n";
+    cout << "6. 5 mistakes allowed maximum\n\n";
+}
+
+// ---------------- GAME LOGIC --------------------------
+bool editPencilMarks(Sudoku* game, int row, int col, int num, int timeLeft)   // false - not "-3 -3 -3" or "row col -num"
+{
+    if (row == -3 && col == -3 && num == -3)                 // Auto marks on, or off again
+        game->setPencilMode(game->getPencilMode() == PENCIL_AUTO ? PENCIL_OFF : PENCIL_AUTO);
+    else if (num < 0 && num >= -9 && row >= 1 && row <= 9 && col >= 1 && col <= 9)
+    {
+        if (!game->togglePencilMark(row, col, -num))
+        {
+            cout << "Pencil marks go in empty cells only.\n";
+            return true;
+        }
+    }
+    else
+        return false;
+    displayBoard(game->getCells(), game, timeLeft);
+    return true;
+}
+
+bool editPencilMarks(Samurai*, int, int, int, int)           // Samurai games have no pencil marks
+{
+    return false;
+}
+
+bool editBranches(Sudoku* game, int row, int col, int num, int timeLeft)   // false - not "-4 -4 -4" or "-4 -4 n"
+{
+    if (row != -4 || col != -4)
+        return false;
+    if (num == -4)
+    {
+        int from = game->getBranch();
+        int branch = game->fork();
+        cout << "Trying branch " << branch << ". Branch " << from << " stays as it is, back to it with -4 -4 " << from << ".\n";
+    }
+    else if (!game->switchBranch(num))
+    {
+        cout << "No branch " << num << ", there " << (game->getBranchCount() == 1 ? "is 1" : "are " + to_string(game->getBranchCount())) << ".\n";
+        return true;
+    }
+    displayBoard(game->getCells(), game, timeLeft);
+    return true;
+}
+
+bool editBranches(Samurai*, int, int, int, int)              // Samurai games have no branches
+{
+    return false;
+}
+
+void showConflicts(Sudoku* game, int row, int col, int num, int timeLeft)   // After a mistake: the board, clashing cells marked
+{
+    CellSet conflicts = game->conflictsOf(row - 1, col - 1, num);
+    if (conflicts.any())
+        displayBoard(game->getCells(), game, timeLeft, conflicts);
+}
+
+void showConflicts(Samurai*, int, int, int, int)             // The 21x21 board does not fit a CellSet
+{
+}
+
+enum MoveResult                                              // Outcome of one "row col num" command
+{
+    MOVE_ACCEPTED,
+    MOVE_SOLVED,
+    MOVE_UNDONE,
+    MOVE_NOTHING_TO_UNDO,
+    MOVE_OUT_OF_RANGE,
+    MOVE_ORIGINAL_CELL,
+    MOVE_MISTAKE,
+    MOVE_GAME_OVER,
+    MOVE_QUIT
+};
+
+int timeLimitMinutes(const string& difficulty)
+{
+    if (difficulty == "samurai")
+        return 45;                                           // Five grids
+    return (difficulty == "easy") ? 15 : (difficulty == "medium") ? 13 : 11;      // Use of ternary operator to set time limit
+}
+
+int difficultyIndex(const string& diff)                      // -1 - not easy, medium or hard
+{
+    for (int d = EASY; d <= HARD; ++d)
+        if (diff == DIFFICULTY_NAMES[d])
+            return d;
+    return -1;
+}
+
+Sudoku* createGame(const string& diff, long long lvl)        // nullptr - unknown difficulty or level
+{
+    if (isGeneratedLevel(lvl))
+        return (difficultyIndex(diff) >= 0) ? new Generated(difficultyIndex(diff), lvl) : nullptr;   // Dynamic Binding of game : a generated puzzle
+    if (lvl < 1 || lvl > MAX_LEVEL)
+        return nullptr;
+    if (diff == "easy")
+        return new Easy(lvl);                                // Dynamic Binding of game : Easy
+    if (diff == "medium")
+        return new Medium(lvl);                              // Dynamic Binding of game : Medium
+    if (diff == "hard")
+        return new Hard(lvl);                                // Dynamic Binding of game : Hard
+    return nullptr;
+}
+
+template <typename Game>                                     // Sudoku or Samurai
+MoveResult checkMove(Game* game, int row, int col, int num)         // Applies one command, see processMove
+{
+    if (row == 0 && col == 0 && num == 0)
+        return MOVE_QUIT;
+
+    if (row == -1 && col == -1 && num == -1)
+        return game->undoMove() ? MOVE_UNDONE : MOVE_NOTHING_TO_UNDO;
+
+    if (row < 1 || row > Game::SIDE || col < 1 || col > Game::SIDE || num < 1 || num > 9 || !game->hasCell(row - 1, col - 1))
+        return MOVE_OUT_OF_RANGE;
+
+    if (game->isOriginalCell(row - 1, col - 1))
+        return MOVE_ORIGINAL_CELL;
+
+    if (game->makeMove(row, col, num))
+        return game->isSolved() ? MOVE_SOLVED : MOVE_ACCEPTED;
+
+    return (game->increaseMistakeCount() >= 5) ? MOVE_GAME_OVER : MOVE_MISTAKE;
+}
+
+template <typename Game>
+MoveResult processMove(Game* game, int row, int col, int num)       // Rules shared by playGame and the server
+{
+    LatencyTimer timer(LATENCY_MOVE);
+    MoveResult result = checkMove(game, row, col, num);
+    int diff = game->getDifficultyIndex();
+    if (result == MOVE_ACCEPTED || result == MOVE_SOLVED)
+        countEvent(diff, COUNT_MOVES);
+    if (result == MOVE_SOLVED)
+        countEvent(diff, COUNT_GAMES_SOLVED);
+    if (result == MOVE_MISTAKE || result == MOVE_GAME_OVER)
+        countEvent(diff, COUNT_MISTAKES);
+    if (result == MOVE_UNDONE)
+        countEvent(diff, COUNT_UNDOS);
+    return result;
+}
+
+// ---------------- HINTS --------------------------------
+// Solves the way a person would, one logical step at a time, for hints and explanations.
+// A StepSolver takes the game's candidates once, copied from the auto pencil marks when the
+// game keeps them, and from then on updates only the cells its own steps touch: a placed
+// digit leaves the peers of its cell, an elimination leaves the cells it names. next() looks
+// for one step, easiest technique first, so a hint costs the work up to that step, never a
+// whole logical solve. Iterating over the solver (range-for) explains the rest of the puzzle
+// step by step.
+enum Technique { TECH_CONTRADICTION, TECH_NAKED_SINGLE, TECH_HIDDEN_SINGLE, TECH_POINTING, TECH_CLAIMING,
+                 TECH_NAKED_PAIR, TECH_HIDDEN_PAIR, TECH_NAKED_TRIPLE, TECH_HIDDEN_TRIPLE, TECH_X_WING, TECHNIQUES };
+const char* const TECHNIQUE_NAMES[] = {"contradiction", "naked single", "hidden single", "pointing", "claiming",
+                                       "naked pair", "hidden pair", "naked triple", "hidden triple", "x-wing"};
+const int MAX_STEP_ELIMINATIONS = 14;                        // X-Wing clears the most: 7 cells in each of 2 lines
+
+string cellName(int p)
+{
+    return "r" + to_string(p / 9 + 1) + "c" + to_string(p % 9 + 1);
+}
+
+string digitsText(uint16_t digits)                           // Bit n set - digit n, as "37"
+{
+    string text;
+    for (int d = 1; d <= 9; ++d)
+        if ((digits >> d) & 1)
+            text += char('0' + d);
+    return text;
+}
+
+string unitName(const Variant& v, int u)
+{
+    if (u < 9)
+        return "row " + to_string(u + 1);
+    if (u < 18)
+        return "column " + to_string(u - 8);
+    if (u < 27)
+        return (strncmp(v.name, "jigsaw", 6) == 0 ? "region " : "box ") + to_string(u - 17);
+    if (strstr(v.name, "diagonal") != nullptr && u < 29)
+        return (u == 27) ? "the main diagonal" : "the anti-diagonal";
+    return "window " + to_string(u - (v.unitCount - 4) + 1);
+}
+
+struct LogicalStep
+{
+    Technique technique;
+    int unit;                                                // Unit the pattern lies in, -1 for a single cell
+    int otherUnit;                                           // Pointing, claiming: unit cleared; X-Wing: second line
+    uint16_t digits;                                         // Digits of the pattern; singles: the digit placed
+    unsigned char cellCount;
+    unsigned char cells[9];                                  // Cells of the pattern; singles: the cell filled
+    unsigned char eliminationCount;
+    unsigned char eliminationCells[MAX_STEP_ELIMINATIONS];
+    uint16_t eliminationDigits[MAX_STEP_ELIMINATIONS];
+
+    bool places() const { return technique == TECH_NAKED_SINGLE || technique == TECH_HIDDEN_SINGLE; }
+
+    string describe(const Variant& v) const                  // "hidden single: r3c7 = 5, the only place for 5 in box 3"
+    {
+        string cellsText;
+        for (int i = 0; i < cellCount; ++i)
+            cellsText += (i > 0 ? " " : "") + cellName(cells[i]);
+        string text = string(TECHNIQUE_NAMES[technique]) + ": ";
+        switch (technique)
+        {
+        case TECH_CONTRADICTION:
+            text += (unit < 0) ? cellsText + " has no candidates left" : "no place left for " + digitsText(digits) + " in " + unitName(v, unit);
+            return text + ", so a digit on the board is wrong";
+        case TECH_NAKED_SINGLE:
+            return text + cellsText + " = " + digitsText(digits) + ", the only candidate left in the cell";
+        case TECH_HIDDEN_SINGLE:
+            return text + cellsText + " = " + digitsText(digits) + ", the only place for " + digitsText(digits) + " in " + unitName(v, unit);
+        case TECH_POINTING:
+        case TECH_CLAIMING:
+            text += digitsText(digits) + " in " + unitName(v, unit) + " lies only in " + unitName(v, otherUnit);
+            break;
+        case TECH_NAKED_PAIR:
+        case TECH_NAKED_TRIPLE:
+            text += cellsText + " hold only " + digitsText(digits) + " in " + unitName(v, unit);
+            break;
+        case TECH_HIDDEN_PAIR:
+        case TECH_HIDDEN_TRIPLE:
+            text += digitsText(digits) + " fit only " + cellsText + " in " + unitName(v, unit);
+            break;
+        default:
+            text += digitsText(digits) + " in " + unitName(v, unit) + " and " + unitName(v, otherUnit) + " lies only in " + cellsText;
+        }
+        text += ", so";
+        for (int i = 0; i < eliminationCount; ++i)
+            text += " " + cellName(eliminationCells[i]) + "<>" + digitsText(eliminationDigits[i]);
+        return text;
+    }
+};
+
+inline uint16_t nextCombination(uint16_t m)                  // Next larger mask with as many bits set
+{
+    uint16_t low = m & -m, ripple = m + low;
+    return (uint16_t)((((ripple ^ m) >> 2) / low) | ripple);
+}
+
+class StepSolver
+{
+    const Sudoku& game;
+    const Variant& v;
+    unsigned char placed[81];                                // Digits placed by this solver's steps, 0 - none
+    uint16_t unitPlaced[MAX_UNITS];                          // ...the same digits per unit
+    uint16_t cand[81];                                       // Candidates of every empty cell, less what the steps ruled out
+    uint16_t where[MAX_UNITS][10];                           // Bit i set - digit may go in the unit's i-th cell
+    bool finished;
+
+    bool isEmpty(int p) const { return game.getCells()[p] == 0 && placed[p] == 0; }
+
+    void eliminate(LogicalStep& step, int q, uint16_t digits)   // Notes the digits that are still candidates at q
+    {
+        digits &= cand[q];
+        if (digits == 0 || step.eliminationCount == MAX_STEP_ELIMINATIONS)
+            return;
+        step.eliminationCells[step.eliminationCount] = (unsigned char)q;
+        step.eliminationDigits[step.eliminationCount++] = digits;
+    }
+
+    void begin(LogicalStep& step, Technique technique, int unit, uint16_t digits)
+    {
+        step.technique = technique;
+        step.unit = unit;
+        step.otherUnit = -1;
+        step.digits = digits;
+        step.cellCount = 0;
+        step.eliminationCount = 0;
+    }
+
+    bool findSingles(LogicalStep& step)                      // Contradictions first, they make every other step moot
+    {
+        int nakedCell = -1, hiddenUnit = -1, hiddenDigit = 0;
+        for (int p = 0; p < 81; ++p)
+        {
+            if (!isEmpty(p))
+                continue;
+            if (cand[p] == 0)
+            {
+                begin(step, TECH_CONTRADICTION, -1, 0);
+                step.cells[step.cellCount++] = (unsigned char)p;
+                return true;
+            }
+            if (nakedCell < 0 && (cand[p] & (cand[p] - 1)) == 0)
+                nakedCell = p;
+        }
+        for (int u = 0; u < v.unitCount; ++u)
+        {
+            uint16_t once = 0, twice = 0;
+            memset(where[u], 0, sizeof(where[u]));
+            for (int i = 0; i < 9; ++i)
+            {
+                uint16_t c = cand[v.units[u][i]];
+                twice |= once & c;
+                once |= c;
+                for (uint16_t bits = c; bits != 0; bits &= bits - 1)
+                    where[u][__builtin_ctz(bits)] |= 1 << i;
+            }
+            uint16_t missing = 0x3FE & ~(game.unitDigits(u) | unitPlaced[u] | once);
+            if (missing != 0)
+            {
+                begin(step, TECH_CONTRADICTION, u, missing & -missing);
+                return true;
+            }
+            uint16_t singles = once & ~twice;
+            if (hiddenUnit < 0 && singles != 0)
+            {
+                hiddenUnit = u;
+                hiddenDigit = __builtin_ctz(singles);
+            }
+        }
+        if (nakedCell >= 0)
+        {
+            begin(step, TECH_NAKED_SINGLE, -1, cand[nakedCell]);
+            step.cells[step.cellCount++] = (unsigned char)nakedCell;
+            return true;
+        }
+        if (hiddenUnit < 0)
+            return false;
+        begin(step, TECH_HIDDEN_SINGLE, hiddenUnit, (uint16_t)(1 << hiddenDigit));
+        step.cells[step.cellCount++] = v.units[hiddenUnit][__builtin_ctz(where[hiddenUnit][hiddenDigit])];
+        return true;
+    }
+
+    bool findLockedCandidates(LogicalStep& step)             // A digit confined to where two units overlap
+    {
+        for (int u = 0; u < v.unitCount; ++u)
+            for (int d = 1; d <= 9; ++d)
+            {
+                uint16_t positions = where[u][d];
+                if (__builtin_popcount(positions) < 2)
+                    continue;
+                int first = v.units[u][__builtin_ctz(positions)];
+                for (int k = 0; k < v.cellUnitCount[first]; ++k)
+                {
+                    int other = v.cellUnits[first][k];
+                    bool inside = other != u;
+                    for (uint16_t bits = positions; bits != 0 && inside; bits &= bits - 1)
+                        inside = memchr(v.units[other], v.units[u][__builtin_ctz(bits)], 9) != nullptr;
+                    if (!inside)
+                        continue;
+                    begin(step, (u >= 18 && u < 27) ? TECH_POINTING : TECH_CLAIMING, u, (uint16_t)(1 << d));
+                    step.otherUnit = other;
+                    for (int i = 0; i < 9; ++i)
+                        if (memchr(v.units[u], v.units[other][i], 9) == nullptr)
+                            eliminate(step, v.units[other][i], step.digits);
+                    if (step.eliminationCount == 0)
+                        continue;
+                    for (uint16_t bits = positions; bits != 0; bits &= bits - 1)
+                        step.cells[step.cellCount++] = v.units[u][__builtin_ctz(bits)];
+                    return true;
+                }
+            }
+        return false;
+    }
+
+    bool findNakedSubset(LogicalStep& step, int size)        // size cells of a unit sharing size candidates
+    {
+        for (int u = 0; u < v.unitCount; ++u)
+        {
+            int items[9], count = 0;
+            for (int i = 0; i < 9; ++i)
+            {
+                int bits = __builtin_popcount(cand[v.units[u][i]]);
+                if (bits >= 2 && bits <= size)
+                    items[count++] = i;
+            }
+            for (uint16_t pick = (uint16_t)((1 << size) - 1); count >= size && pick < (1 << count); pick = nextCombination(pick))
+            {
+                uint16_t digits = 0, inPattern = 0;
+                for (uint16_t bits = pick; bits != 0; bits &= bits - 1)
+                {
+                    int i = items[__builtin_ctz(bits)];
+                    digits |= cand[v.units[u][i]];
+                    inPattern |= 1 << i;
+                }
+                if (__builtin_popcount(digits) != size)
+                    continue;
+                begin(step, size == 2 ? TECH_NAKED_PAIR : TECH_NAKED_TRIPLE, u, digits);
+                for (int i = 0; i < 9; ++i)
+                    if (!((inPattern >> i) & 1))
+                        eliminate(step, v.units[u][i], digits);
+                if (step.eliminationCount == 0)
+                    continue;
+                for (uint16_t bits = inPattern; bits != 0; bits &= bits - 1)
+                    step.cells[step.cellCount++] = v.units[u][__builtin_ctz(bits)];
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool findHiddenSubset(LogicalStep& step, int size)       // size digits of a unit that fit only size cells
+    {
+        for (int u = 0; u < v.unitCount; ++u)
+        {
+            int items[9], count = 0;
+            for (int d = 1; d <= 9; ++d)
+            {
+                int bits = __builtin_popcount(where[u][d]);
+                if (bits >= 2 && bits <= size)
+                    items[count++] = d;
+            }
+            for (uint16_t pick = (uint16_t)((1 << size) - 1); count >= size && pick < (1 << count); pick = nextCombination(pick))
+            {
+                uint16_t digits = 0, positions = 0;
+                for (uint16_t bits = pick; bits != 0; bits &= bits - 1)
+                {
+                    int d = items[__builtin_ctz(bits)];
+                    digits |= 1 << d;
+                    positions |= where[u][d];
+                }
+                if (__builtin_popcount(positions) != size)
+                    continue;
+                begin(step, size == 2 ? TECH_HIDDEN_PAIR : TECH_HIDDEN_TRIPLE, u, digits);
+                for (uint16_t bits = positions; bits != 0; bits &= bits - 1)
+                {
+                    int q = v.units[u][__builtin_ctz(bits)];
+                    step.cells[step.cellCount++] = (unsigned char)q;
+                    eliminate(step, q, (uint16_t)~digits);
+                }
+                if (step.eliminationCount > 0)
+                    return true;
+            }
+        }
+        return false;
+    }
+
+    bool findXWing(LogicalStep& step)                        // A digit in two lines limited to the same two cross lines
+    {
+        for (int base = 0; base <= 9; base += 9)             // Rows, then columns
+            for (int d = 1; d <= 9; ++d)
+                for (int a = base; a < base + 9; ++a)
+                {
+                    uint16_t positions = where[a][d];
+                    if (__builtin_popcount(positions) != 2)
+                        continue;
+                    for (int b = a + 1; b < base + 9; ++b)
+                    {
+                        if (where[b][d] != positions)
+                            continue;
+                        begin(step, TECH_X_WING, a, (uint16_t)(1 << d));
+                        step.otherUnit = b;
+                        for (uint16_t bits = positions; bits != 0; bits &= bits - 1)
+                        {
+                            int cross = 9 - base + __builtin_ctz(bits);      // Column i of a row, row i of a column
+                            for (int i = 0; i < 9; ++i)
+                                if (i != a - base && i != b - base)
+                                    eliminate(step, v.units[cross][i], step.digits);
+                        }
+                        if (step.eliminationCount == 0)
+                            continue;
+                        step.cells[0] = v.units[a][__builtin_ctz(positions)];
+                        step.cells[1] = v.units[a][31 - __builtin_clz(positions)];
+                        step.cells[2] = v.units[b][__builtin_ctz(positions)];
+                        step.cells[3] = v.units[b][31 - __builtin_clz(positions)];
+                        step.cellCount = 4;
+                        return true;
+                    }
+                }
+        return false;
+    }
+
+    void apply(const LogicalStep& step)
+    {
+        if (step.places())
+        {
+            int p = step.cells[0], num = __builtin_ctz(step.digits);
+            placed[p] = (unsigned char)num;
+            cand[p] = 0;
+            for (int k = 0; k < v.cellUnitCount[p]; ++k)
+                unitPlaced[v.cellUnits[p][k]] |= 1 << num;
+            for (int w = 0; w < 2; ++w)                      // Only the peers lose the digit
+                for (uint64_t peers = v.peers[p][w]; peers != 0; peers &= peers - 1)
+                    cand[w * 64 + __builtin_ctzll(peers)] &= (uint16_t)~step.digits;
+        }
+        for (int i = 0; i < step.eliminationCount; ++i)
+            cand[step.eliminationCells[i]] &= (uint16_t)~step.eliminationDigits[i];
+        finished = step.technique == TECH_CONTRADICTION;
+    }
+public:
+    StepSolver(const Sudoku& g) : game(g), v(g.getVariant()), finished(false)
+    {
+        memset(placed, 0, sizeof(placed));
+        memset(unitPlaced, 0, sizeof(unitPlaced));
+        const PencilMarks* marks = g.getPencilMarks();       // Auto marks skip the Killer cage rule, candidates() does not
+        if (marks != nullptr && marks->holdsCandidates() && v.cageCount == 0)
+            for (int p = 0; p < 81; ++p)
+                cand[p] = marks->at(p);
+        else
+            for (int p = 0; p < 81; ++p)
+                cand[p] = g.candidates(p);
+    }
+
+    bool next(LogicalStep& step)                             // false - solved, or stuck for these techniques
+    {
+        if (finished)
+            return false;
+        bool found = findSingles(step) || findLockedCandidates(step) || findNakedSubset(step, 2) || findHiddenSubset(step, 2)
+                     || findNakedSubset(step, 3) || findHiddenSubset(step, 3) || findXWing(step);
+        if (found)
+            apply(step);
+        return found;
+    }
+
+    int emptyCells() const                                   // Cells neither the game nor a step has filled
+    {
+        int count = 0;
+        for (int p = 0; p < 81; ++p)
+            count += isEmpty(p);
+        return count;
+    }
+
+    class Iterator                                           // Input iterator, each ++ runs one next()
+    {
+        StepSolver* solver;                                  // nullptr once there are no more steps
+        LogicalStep step;
+    public:
+        Iterator(StepSolver* s) : solver(s) { ++*this; }
+        const LogicalStep& operator*() const { return step; }
+        Iterator& operator++()
+        {
+            if (solver != nullptr && !solver->next(step))
+                solver = nullptr;
+            return *this;
+        }
+        bool operator!=(const Iterator& other) const { return solver != other.solver; }
+    };
+    Iterator begin() { return Iterator(this); }
+    Iterator end() { return Iterator(nullptr); }
+};
+
+bool nextHint(const Sudoku* game, LogicalStep& step)         // false - solved, or no step the techniques can find
+{
+    StepSolver solver(*game);
+    if (!solver.next(step))
+        return false;
+    countEvent(game->getDifficultyIndex(), COUNT_HINTS);
+    return true;
+}
+
+void showHint(const Sudoku* game)
+{
+    LogicalStep step;
+    if (nextHint(game, step))
+        cout << "Hint: " << step.describe(game->getVariant()) << "\n";
+    else
+        cout << "No hint: the next step needs a technique beyond x-wing.\n";
+}
+
+void showHint(const Samurai*)                                // Samurai games have no step solver
+{
+    cout << "Hints are not available for Samurai games.\n";
+}
+
+// ---------------- SAVE AND RESUME ----------------------
+// A game is stored as a fixed 48 byte snapshot (version 1):
+//   byte  0      version
+//   byte  1      difficulty (bits 0-1: easy, medium, hard) | (level - 1) << 2
+//   byte  2      mistake count
+//   bytes 3-4    elapsed seconds, little endian
+//   bytes 5-6    undo journal: cell 0-80 (0xFF = nothing to undo) and the value it had before the last move
+//   bytes 7-47   81 cells, 4 bits each, two cells per byte
+// Derived levels (variation above 0) are stored as version 2, in the same 48 bytes:
+//   byte  1      difficulty | (shipped level - 1) << 2
+//   bytes 7-40   81 cells, three per 10 bits (100a + 10b + c), little endian bit order
+//   bytes 41-47  variation of the level, little endian
+// Generated puzzles (see PUZZLE POOL) are stored as version 2 as well, their level id split the same way.
+const int SNAPSHOT_VERSION = 1;
+const int SNAPSHOT_VARIATION_VERSION = 2;
+const int SNAPSHOT_BYTES = 48;
+const char* SAVE_FILE = "savegame.dat";
+const int PACKED_CELL_BYTES = 41;
+
+void packCells(const unsigned char* cells, unsigned char* out)  // 81 cells, 4 bits each, two cells per byte
+{
+    for (int p = 0; p < 81; p += 2)
+        out[p / 2] = (unsigned char)(cells[p] | (p + 1 < 81 ? cells[p + 1] << 4 : 0));
+}
+
+bool unpackCells(const unsigned char* in, unsigned char* cells)  // false - a cell is not 0-9
+{
+    for (int p = 0; p < 81; ++p)
+    {
+        int value = (in[p / 2] >> ((p & 1) * 4)) & 0xF;
+        if (value > 9)
+            return false;
+        cells[p] = (unsigned char)value;
+    }
+    return true;
+}
+
+void writeSnapshot(const Sudoku* game, int elapsedSecs, unsigned char* out)    // out must hold SNAPSHOT_BYTES
+{
+    const unsigned char* cells = game->getCells();
+    if (elapsedSecs < 0) elapsedSecs = 0;
+    if (elapsedSecs > 0xFFFF) elapsedSecs = 0xFFFF;
+
+    uint64_t variation = levelVariation(game->getLevel());
+    out[0] = (variation == 0) ? SNAPSHOT_VERSION : SNAPSHOT_VARIATION_VERSION;
+    out[1] = (unsigned char)(game->getDifficultyIndex() | (baseLevel(game->getLevel()) - 1) << 2);
+    out[2] = (unsigned char)game->getMistakeCount();
+    out[3] = (unsigned char)(elapsedSecs & 0xFF);
+    out[4] = (unsigned char)(elapsedSecs >> 8);
+    out[5] = (unsigned char)game->getUndoCell();
+    out[6] = (unsigned char)game->getUndoValue();
+    if (variation == 0)
+    {
+        packCells(cells, out + 7);
+        return;
+    }
+    memset(out + 7, 0, SNAPSHOT_BYTES - 7);
+    for (int g = 0; g < 27; ++g)
+    {
+        int value = cells[g * 3] * 100 + cells[g * 3 + 1] * 10 + cells[g * 3 + 2];
+        for (int b = 0; b < 10; ++b)
+            out[7 + (g * 10 + b) / 8] |= (unsigned char)(((value >> b) & 1) << ((g * 10 + b) % 8));
+    }
+    for (int i = 0; i < 7; ++i)
+        out[41 + i] = (unsigned char)(variation >> (i * 8));
+}
+
+Sudoku* readSnapshot(const unsigned char* in, int size, int& elapsedSecs)     // nullptr - corrupt or unknown version
+{
+    if (size != SNAPSHOT_BYTES || (in[0] != SNAPSHOT_VERSION && in[0] != SNAPSHOT_VARIATION_VERSION))
+        return nullptr;
+    int diff = in[1] & 3;
+    long long lvl = (in[1] >> 2) + 1;
+    if (diff > 2 || lvl > SHIPPED_LEVELS || in[2] >= 5 || (in[5] != NO_UNDO && (in[5] > 80 || in[6] > 9)))
+        return nullptr;
+
+    unsigned char cells[81];
+    if (in[0] == SNAPSHOT_VERSION)
+    {
+        if (!unpackCells(in + 7, cells))
+            return nullptr;
+    }
+    else
+    {
+        for (int g = 0; g < 27; ++g)
+        {
+            int value = 0;
+            for (int b = 0; b < 10; ++b)
+                value |= ((in[7 + (g * 10 + b) / 8] >> ((g * 10 + b) % 8)) & 1) << b;
+            if (value > 999)
+                return nullptr;
+            cells[g * 3] = (unsigned char)(value / 100);
+            cells[g * 3 + 1] = (unsigned char)(value / 10 % 10);
+            cells[g * 3 + 2] = (unsigned char)(value % 10);
+        }
+        uint64_t variation = 0;
+        for (int i = 0; i < 7; ++i)
+            variation |= (uint64_t)in[41 + i] << (i * 8);
+        if (variation == 0)
+            return nullptr;                                  // createGame() checks the rest of the level id
+        lvl += (long long)variation * SHIPPED_LEVELS;
+    }
+
+    Sudoku* game = createGame(DIFFICULTY_NAMES[diff], lvl);
+    if (game == nullptr)
+        return nullptr;
+    game->getSudoku();
+    if (!game->restoreState(cells, in[5], in[6], in[2]))
+    {
+        delete game;
+        return nullptr;
+    }
+    elapsedSecs = in[3] | in[4] << 8;
+    return game;
+}
+
+bool saveGameToFile(const Sudoku* game, int elapsedSecs, const char* path)
+{
+    unsigned char snapshot[SNAPSHOT_BYTES];
+    writeSnapshot(game, elapsedSecs, snapshot);
+    ofstream file(path, ios::binary);
+    file.write((const char*)snapshot, SNAPSHOT_BYTES);
+    return bool(file);
+}
+
+Sudoku* loadGameFromFile(const char* path, int& elapsedSecs)  // nullptr - no save or unreadable
+{
+    unsigned char snapshot[SNAPSHOT_BYTES];
+    ifstream file(path, ios::binary);
+    if (!file.read((char*)snapshot, SNAPSHOT_BYTES))
+        return nullptr;
+    return readSnapshot(snapshot, SNAPSHOT_BYTES, elapsedSecs);
+}
+
+bool saveGameToFile(const Samurai*, int, const char*)        // Samurai games are not saved
+{
+    return false;
+}
+
+// ---------------- PLAY LOOP ----------------------------
+template <typename Game>                                     // Sudoku or Samurai
+bool playGame(Game* game, bool resumed = false, int elapsedBefore = 0)       // resumed - board already restored from a snapshot
+{
+    const unsigned char* board = resumed ? game->getCells() : game->getSudoku();
+    int totalMinutes = timeLimitMinutes(game->getDifficulty());
+
+    auto startTime = steady_clock::now() - seconds(elapsedBefore);     // now() returns time_point form monotic clock of chrono::steady_clock
+
+    cout << "\nGAME STARTS!\nYou have limited time and 5 mistakes allowed.\n";
+    displayBoard(board, game, totalMinutes * 60 - elapsedBefore);
+
+    bool gameOver = false;
+
+    while (!gameOver)
+    {
+        auto now = steady_clock::now();
+        int timePassed = duration_cast<seconds>(now - startTime).count();
+        int timeLeft = totalMinutes * 60 - timePassed;
+
+        if (timeLeft <= 0)
+        {
+            countEvent(game->getDifficultyIndex(), COUNT_TIMEOUTS);
+            cout << "\nTime's up! Game Over.\n";
+            return true;
+        }
+
+        int row, col, num;
+        cout << "\nEnter row, column, number (or -1 -1 -1 for undo, -2 -2 -2 for a hint, row col -num for a pencil mark,"
+                " -3 -3 -3 for auto marks, -4 -4 -4 to try a branch, -4 -4 n to go to branch n or 0 0 0 to quit): ";
+        cin >> row >> col >> num;
+
+        if (row == -2 && col == -2 && num == -2)             // Not a move: no mistake, nothing to undo
+        {
+            showHint(game);
+            continue;
+        }
+        if (editPencilMarks(game, row, col, num, timeLeft) || editBranches(game, row, col, num, timeLeft))   // Not moves either
+            continue;
+
+        switch (processMove(game, row, col, num))
+        {
+        case MOVE_QUIT:
+            if (saveGameToFile(game, timePassed, SAVE_FILE))
+                cout << "Game saved. ";
+            cout << "Exiting...\n";
+            return true;
+        case MOVE_UNDONE:
+            cout << "Move undone successfully.\n";
+            displayBoard(game->getCells(), game, timeLeft);
+            break;
+        case MOVE_NOTHING_TO_UNDO:
+            cout << "No moves to undo.\n";
+            displayBoard(game->getCells(), game, timeLeft);
+            break;
+        case MOVE_OUT_OF_RANGE:
+            if (Game::SIDE == 9)
+                cout << "Invalid input! Must be 1-9.\n";
+            else
+                cout << "Invalid input! Row and column must be a cell of the board (1-" << Game::SIDE << "), number 1-9.\n";
+            break;
+        case MOVE_ORIGINAL_CELL:
+            cout << "Cannot modify original clue!\n";
+            break;
+        case MOVE_ACCEPTED:
+            cout << "Move accepted!\n";
+            displayBoard(game->getCells(), game, timeLeft);
+            break;
+        case MOVE_SOLVED:
+            cout << "Move accepted!\n";
+            displayBoard(game->getCells(), game, timeLeft);
+            cout << "\nCongratulations! You solved the Sudoku!\nWell played! ";
+            cout << "Time taken: " << timePassed / 60 << " minutes\n";
+            gameOver = true;
+            break;
+        case MOVE_MISTAKE:
+            cout << "Invalid move! Mistakes: " << game->getMistakeCount() << "/5\n";
+            showConflicts(game, row, col, num, timeLeft);
+            break;
+        case MOVE_GAME_OVER:
+            cout << "Invalid move! Mistakes: " << game->getMistakeCount() << "/5\n";
+            cout << "Too many mistakes! Game Over.\nBetter luck next time!\n";
+            return true;
+        }
+    }
+    return true;
+}
+
+// ---------------- MOVE LOG -----------------------------
+// Append-only log of every accepted move, undo and mistake of hosted games.
+// Records are buffered and written with one fdatasync per commit interval (group commit),
+// so many moves share one disk flush. A checkpoint writes all live games as snapshots to
+// <log>.snap and empties the log; recovery loads the checkpoint and replays the log tail.
+//
+// Record (12 bytes): lsn (4) | session id (4) | type (1) | a b c (3)
+//   LOG_NEW     a = difficulty 0-2, b = level 1-10 (a derived level is logged as LOG_RESUME)
+//   LOG_MOVE    a b c = row col num (1-based, as typed)
+//   LOG_UNDO, LOG_MISTAKE, LOG_END
+//   LOG_RESUME  followed by a SNAPSHOT_BYTES snapshot
+// Log sequence numbers (lsn) are consecutive, so a torn or garbage tail stops the replay.
+#ifdef __linux__
+enum LogRecordType
+{
+    LOG_NEW = 1,
+    LOG_MOVE,
+    LOG_UNDO,
+    LOG_MISTAKE,
+    LOG_END,
+    LOG_RESUME
+};
+
+const int LOG_RECORD_BYTES = 12;
+
+struct LoggedGame                                            // A game as written to / read back from the log
+{
+    uint32_t id;
+    Sudoku* game;
+    int elapsedSecs;
+};
+
+void putU32(unsigned char* p, uint32_t v)
+{
+    p[0] = v & 0xFF; p[1] = (v >> 8) & 0xFF; p[2] = (v >> 16) & 0xFF; p[3] = v >> 24;
+}
+
+uint32_t getU32(const unsigned char* p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+bool writeFully(int fd, const unsigned char* data, size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t n = write(fd, data, size);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+class MoveLog
+{
+    int fd;
+    string path;
+    int commitIntervalMs;
+    size_t checkpointBytes;                                  // Log size that triggers a checkpoint
+    vector<unsigned char> buffer;                            // Records not yet written
+    uint32_t nextLsn;
+    size_t logSize;
+    steady_clock::time_point lastCommit;
+public:
+    long long bytesWritten;                                  // Log + checkpoint bytes, for write amplification
+    long long records;
+    long long syncs;
+
+    MoveLog() : fd(-1), commitIntervalMs(2), checkpointBytes(4 << 20), nextLsn(1), logSize(0),
+                bytesWritten(0), records(0), syncs(0) {};
+    ~MoveLog() { if (fd >= 0) close(fd); }
+
+    bool isOpen() const { return fd >= 0; }
+
+    // Replays <path>.snap and <path> into games, then opens the log for appending.
+    bool open(const string& logPath, int intervalMs, vector<LoggedGame>& games)
+    {
+        path = logPath;
+        commitIntervalMs = intervalMs;
+        map<uint32_t, LoggedGame> live;
+        uint32_t lastLsn = 0;
+
+        ifstream snap(path + ".snap", ios::binary);
+        unsigned char header[12];
+        if (snap.read((char*)header, 12) && memcmp(header, "SDK1", 4) == 0)
+        {
+            lastLsn = getU32(header + 4);
+            uint32_t count = getU32(header + 8);
+            unsigned char entry[4 + SNAPSHOT_BYTES];
+            for (uint32_t i = 0; i < count && snap.read((char*)entry, sizeof(entry)); ++i)
+            {
+                LoggedGame g{getU32(entry), nullptr, 0};
+                g.game = readSnapshot(entry + 4, SNAPSHOT_BYTES, g.elapsedSecs);
+                if (g.game != nullptr)
+                    live[g.id] = g;
+            }
+        }
+        snap.close();
+
+        ifstream log(path, ios::binary);
+        unsigned char rec[LOG_RECORD_BYTES + SNAPSHOT_BYTES];
+        uint32_t expected = 0;                               // 0 - first record may have any lsn
+        while (log.read((char*)rec, LOG_RECORD_BYTES))
+        {
+            uint32_t lsn = getU32(rec);
+            if (expected != 0 && lsn != expected)
+                break;                                       // Torn tail from a crash
+            expected = lsn + 1;
+            if (rec[8] == LOG_RESUME && !log.read((char*)rec + LOG_RECORD_BYTES, SNAPSHOT_BYTES))
+                break;
+            if (lsn > lastLsn)
+            {
+                replay(live, rec);
+                lastLsn = lsn;
+            }
+        }
+        log.close();
+
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT, 0644);      // Emptied only after the checkpoint below is durable
+        if (fd < 0)
+            return false;
+        nextLsn = lastLsn + 1;
+        lastCommit = steady_clock::now();
+        for (auto& entry : live)
+            games.push_back(entry.second);
+        return checkpoint(games);                            // Recovered state becomes the new base, log starts empty
+    }
+
+    static void replay(map<uint32_t, LoggedGame>& live, const unsigned char* rec)
+    {
+        uint32_t id = getU32(rec + 4);
+        auto it = live.find(id);
+        Sudoku* game = (it == live.end()) ? nullptr : it->second.game;
+        switch (rec[8])
+        {
+        case LOG_NEW:
+        case LOG_RESUME:
+        {
+            LoggedGame g{id, nullptr, 0};
+            if (rec[8] == LOG_NEW && rec[9] <= 2)
+            {
+                g.game = createGame(DIFFICULTY_NAMES[rec[9]], rec[10]);
+                if (g.game != nullptr)
+                    g.game->getSudoku();
+            }
+            else if (rec[8] == LOG_RESUME)
+                g.game = readSnapshot(rec + LOG_RECORD_BYTES, SNAPSHOT_BYTES, g.elapsedSecs);
+            delete game;
+            if (g.game != nullptr)
+                live[id] = g;
+            else if (it != live.end())
+                live.erase(it);
+            break;
+        }
+        case LOG_MOVE:
+            if (game != nullptr)
+                game->makeMove(rec[9], rec[10], rec[11]);
+            break;
+        case LOG_UNDO:
+            if (game != nullptr)
+                game->undoMove();
+            break;
+        case LOG_MISTAKE:
+            if (game != nullptr)
+                game->increaseMistakeCount();
+            break;
+        case LOG_END:
+            if (game != nullptr)
+            {
+                delete game;
+                live.erase(it);
+            }
+            break;
+        }
+    }
+
+    void append(uint32_t id, LogRecordType type, int a = 0, int b = 0, int c = 0, const unsigned char* snapshot = nullptr)
+    {
+        if (fd < 0)
+            return;
+        size_t at = buffer.size();
+        buffer.resize(at + LOG_RECORD_BYTES + (type == LOG_RESUME ? SNAPSHOT_BYTES : 0));
+        putU32(&buffer[at], nextLsn++);
+        putU32(&buffer[at + 4], id);
+        buffer[at + 8] = (unsigned char)type;
+        buffer[at + 9] = (unsigned char)a;
+        buffer[at + 10] = (unsigned char)b;
+        buffer[at + 11] = (unsigned char)c;
+        if (type == LOG_RESUME)
+            memcpy(&buffer[at + LOG_RECORD_BYTES], snapshot, SNAPSHOT_BYTES);
+        ++records;
+    }
+
+    bool hasPending() const { return !buffer.empty(); }
+
+    int msUntilCommit() const                                // Timeout for epoll_wait, -1 - nothing to commit
+    {
+        if (buffer.empty())
+            return -1;
+        int passed = duration_cast<milliseconds>(steady_clock::now() - lastCommit).count();
+        return (passed >= commitIntervalMs) ? 0 : commitIntervalMs - passed;
+    }
+
+    bool needsCheckpoint() const { return logSize >= checkpointBytes; }
+
+    bool commit()                                            // One write and one fdatasync for every buffered record
+    {
+        lastCommit = steady_clock::now();
+        if (buffer.empty())
+            return true;
+        if (!writeFully(fd, buffer.data(), buffer.size()) || fdatasync(fd) != 0)
+            return false;
+        logSize += buffer.size();
+        bytesWritten += buffer.size();
+        ++syncs;
+        buffer.clear();
+        return true;
+    }
+
+    bool checkpoint(const vector<LoggedGame>& games)         // Snapshot every game, then empty the log
+    {
+        if (!commit())
+            return false;
+        vector<unsigned char> data(12 + games.size() * (4 + SNAPSHOT_BYTES));
+        memcpy(&data[0], "SDK1", 4);
+        putU32(&data[4], nextLsn - 1);
+        putU32(&data[8], (uint32_t)games.size());
+        size_t at = 12;
+        for (const LoggedGame& g : games)
+        {
+            putU32(&data[at], g.id);
+            writeSnapshot(g.game, g.elapsedSecs, &data[at + 4]);
+            at += 4 + SNAPSHOT_BYTES;
+        }
+
+        string tmp = path + ".snap.tmp";
+        int snapFd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (snapFd < 0)
+            return false;
+        bool ok = writeFully(snapFd, data.data(), data.size()) && fsync(snapFd) == 0;
+        close(snapFd);
+        if (!ok || rename(tmp.c_str(), (path + ".snap").c_str()) != 0)
+            return false;
+        bytesWritten += data.size();
+        ++syncs;
+
+        if (ftruncate(fd, 0) != 0 || lseek(fd, 0, SEEK_SET) != 0)   // Records up to the snapshot lsn are no longer needed
+            return false;
+        logSize = 0;
+        return true;
+    }
+};
+
+void logMoveResult(MoveLog& log, uint32_t id, MoveResult result, int row, int col, int num)
+{
+    switch (result)
+    {
+    case MOVE_ACCEPTED:
+        log.append(id, LOG_MOVE, row, col, num);
+        break;
+    case MOVE_SOLVED:
+        log.append(id, LOG_MOVE, row, col, num);
+        log.append(id, LOG_END);
+        break;
+    case MOVE_UNDONE:
+        log.append(id, LOG_UNDO);
+        break;
+    case MOVE_MISTAKE:
+        log.append(id, LOG_MISTAKE);
+        break;
+    case MOVE_GAME_OVER:
+        log.append(id, LOG_MISTAKE);
+        log.append(id, LOG_END);
+        break;
+    default:                                                 // Nothing changed
+        break;
+    }
+}
+#endif
+
+// ---------------- GAME SERVER --------------------------
+// Hosts many games at once over local TCP or a Unix socket.
+// Protocol is one command per line, one reply line per command:
+//   new <easy|medium|hard> <level>  ->  BOARD <81 digits, 0 = empty>   (level 1-10, a derived level id, or 0 for a pooled generated puzzle)
+//   board                           ->  BOARD <81 digits>
+//   hint                            ->  HINT <technique>: <step, see HINTS> | NO_HINT
+//   conflicts <row> <col> <num>     ->  CONFLICTS <81 digits, 1 = cell clashes with num there>
+//   save                            ->  SNAPSHOT <96 hex digits>
+//   resume <96 hex digits>          ->  BOARD <81 digits>
+//   id                              ->  SESSION <id>
+//   attach <id>                     ->  BOARD <81 digits> (take over a game recovered from the move log)
+//   metrics                         ->  Prometheus text, ended by a "# EOF" line
+//   metrics <file>                  ->  OK (same text written to the file)
+//   <row> <col> <num>               ->  ACCEPTED | SOLVED <secs> | MISTAKE <n> | GAME_OVER | CLUE | INVALID | TIME_UP
+//   -1 -1 -1                        ->  UNDONE | NO_UNDO
+//   0 0 0                           ->  BYE (connection is closed)
+// Every session keeps its own Sudoku object, so mistakes, timer and undo are per client.
+// With --log, replies are held back until the moves they confirm are committed to the move log.
+string boardToString(const unsigned char* board)
+{
+    string cells(81, '0');
+    for (int p = 0; p < 81; ++p)
+        cells[p] = char('0' + board[p]);
+    return cells;
+}
+
+#ifdef __linux__
+struct Session
+{
+    int fd;
+    uint32_t id;                                             // Stable across restarts, used by the move log
+    Sudoku* game;                                            // nullptr until the client sends "new"
+    steady_clock::time_point startTime;
+    string in;                                               // Bytes read but not yet a full line
+    string out;                                              // Replies waiting to be written
+    bool closing;
+    bool waitingToWrite;                                     // true - registered for EPOLLOUT
+    bool waitingForCommit;                                   // true - replies held until the log is synced
+};
+
+struct ServerState
+{
+    MoveLog log;
+    map<uint32_t, Session*> detached;                        // Recovered games nobody has attached to yet
+    uint32_t nextSessionId;
+};
+
+void endGame(ServerState& server, Session* s)                // Game finished, abandoned or replaced
+{
+    if (s->game == nullptr)
+        return;
+    server.log.append(s->id, LOG_END);
+    delete s->game;
+    s->game = nullptr;
+}
+
+bool setNonBlocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+int openSocket(const string& kind, const string& address, bool listening)     // -1 - socket/bind/connect failed
+{
+    int fd;
+    if (kind == "unix")
+    {
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, address.c_str(), sizeof(addr.sun_path) - 1);
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0)
+            return -1;
+        if (listening)
+        {
+            unlink(address.c_str());                         // Remove a stale socket file from an earlier run
+            if (bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0)
+            {
+                close(fd);
+                return -1;
+            }
+        }
+        else if (connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0)
+        {
+            close(fd);
+            return -1;
+        }
+    }
+    else
+    {
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(atoi(address.c_str()));
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);       // Local play only
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0)
+            return -1;
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        if (listening)
+        {
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+            if (bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0)
+            {
+                close(fd);
+                return -1;
+            }
+        }
+        else if (connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0)
+        {
+            close(fd);
+            return -1;
+        }
+    }
+    if (listening && (listen(fd, SOMAXCONN) < 0 || !setNonBlocking(fd)))
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+void handleCommand(ServerState& server, Session* s, const char* line)
+{
+    while (*line == ' ' || *line == '\t')
+        ++line;
+
+    if (strncmp(line, "new", 3) == 0)
+    {
+        char diff[16];
+        long long lvl;
+        if (sscanf(line + 3, "%15s %lld", diff, &lvl) != 2)
+        {
+            s->out += "ERROR usage: new <easy|medium|hard> <level>\n";
+            return;
+        }
+        Sudoku* game = nullptr;
+        int pooled = (lvl == 0) ? difficultyIndex(diff) : -1;
+        if (pooled >= 0)
+            game = newPooledGame(pooled);                    // One queue pop, already started
+        else
+        {
+            game = createGame(diff, lvl);
+            if (game != nullptr)
+                game->getSudoku();
+        }
+        if (game == nullptr)
+        {
+            s->out += "ERROR invalid difficulty or level\n";
+            return;
+        }
+        endGame(server, s);
+        s->game = game;
+        s->startTime = steady_clock::now();
+        if (game->getLevel() <= SHIPPED_LEVELS)
+            server.log.append(s->id, LOG_NEW, game->getDifficultyIndex(), (int)game->getLevel());
+        else
+        {
+            unsigned char snapshot[SNAPSHOT_BYTES];          // A derived level id does not fit the record
+            writeSnapshot(s->game, 0, snapshot);
+            server.log.append(s->id, LOG_RESUME, 0, 0, 0, snapshot);
+        }
+        s->out += "BOARD " + boardToString(s->game->getCells()) + "\n";
+        return;
+    }
+
+    if (strncmp(line, "save", 4) == 0)
+    {
+        if (s->game == nullptr)
+        {
+            s->out += "ERROR no game, send: new <difficulty> <level>\n";
+            return;
+        }
+        unsigned char snapshot[SNAPSHOT_BYTES];
+        writeSnapshot(s->game, duration_cast<seconds>(steady_clock::now() - s->startTime).count(), snapshot);
+        static const char hexDigits[] = "0123456789abcdef";
+        s->out += "SNAPSHOT ";
+        for (int i = 0; i < SNAPSHOT_BYTES; ++i)
+        {
+            s->out += hexDigits[snapshot[i] >> 4];
+            s->out += hexDigits[snapshot[i] & 0xF];
+        }
+        s->out += "\n";
+        return;
+    }
+
+    if (strncmp(line, "resume", 6) == 0)
+    {
+        unsigned char snapshot[SNAPSHOT_BYTES];
+        const char* hex = line + 6;
+        while (*hex == ' ')
+            ++hex;
+        int size = 0;
+        while (size < SNAPSHOT_BYTES && isxdigit((unsigned char)hex[0]) && isxdigit((unsigned char)hex[1]))
+        {
+            char byteText[3] = {hex[0], hex[1], '\0'};
+            snapshot[size++] = (unsigned char)strtol(byteText, nullptr, 16);
+            hex += 2;
+        }
+        int elapsedSecs = 0;
+        Sudoku* game = readSnapshot(snapshot, size, elapsedSecs);
+        if (game == nullptr)
+        {
+            s->out += "ERROR invalid snapshot\n";
+            return;
+        }
+        endGame(server, s);
+        s->game = game;
+        s->startTime = steady_clock::now() - seconds(elapsedSecs);
+        server.log.append(s->id, LOG_RESUME, 0, 0, 0, snapshot);
+        s->out += "BOARD " + boardToString(s->game->getCells()) + "\n";
+        return;
+    }
+
+    if (strncmp(line, "metrics", 7) == 0)
+    {
+        const char* path = line + 7;
+        while (*path == ' ')
+            ++path;
+        if (*path == '\0')
+            s->out += exportMetrics() + "# EOF\n";
+        else
+            s->out += exportMetricsToFile(path) ? "OK\n" : "ERROR cannot write metrics file\n";
+        return;
+    }
+
+    if (strncmp(line, "id", 2) == 0)
+    {
+        s->out += "SESSION " + to_string(s->id) + "\n";
+        return;
+    }
+
+    if (strncmp(line, "attach", 6) == 0)
+    {
+        auto it = server.detached.find((uint32_t)strtoul(line + 6, nullptr, 10));
+        if (it == server.detached.end())
+        {
+            s->out += "ERROR no such session\n";
+            return;
+        }
+        endGame(server, s);
+        Session* recovered = it->second;
+        server.detached.erase(it);
+        s->id = recovered->id;                               // Later moves continue the recovered game's log
+        s->game = recovered->game;
+        s->startTime = recovered->startTime;
+        delete recovered;
+        s->out += "BOARD " + boardToString(s->game->getCells()) + "\n";
+        return;
+    }
+
+    if (strncmp(line, "board", 5) == 0)
+    {
+        if (s->game == nullptr)
+            s->out += "ERROR no game, send: new <difficulty> <level>\n";
+        else
+            s->out += "BOARD " + boardToString(s->game->getCells()) + "\n";
+        return;
+    }
+
+    if (strncmp(line, "conflicts", 9) == 0)
+    {
+        int row, col, num;
+        if (s->game == nullptr)
+            s->out += "ERROR no game, send: new <difficulty> <level>\n";
+        else if (sscanf(line + 9, "%d %d %d", &row, &col, &num) != 3 || row < 1 || row > 9 || col < 1 || col > 9 || num < 1 || num > 9)
+            s->out += "ERROR usage: conflicts <row> <col> <num>\n";
+        else
+        {
+            CellSet conflicts = s->game->conflictsOf(row - 1, col - 1, num);
+            string cells(81, '0');
+            for (int p = 0; p < 81; ++p)
+                if (conflicts.has(p))
+                    cells[p] = '1';
+            s->out += "CONFLICTS " + cells + "\n";
+        }
+        return;
+    }
+
+    if (strncmp(line, "hint", 4) == 0)
+    {
+        LogicalStep step;
+        if (s->game == nullptr)
+            s->out += "ERROR no game, send: new <difficulty> <level>\n";
+        else if (nextHint(s->game, step))
+            s->out += "HINT " + step.describe(s->game->getVariant()) + "\n";
+        else
+            s->out += "NO_HINT\n";
+        return;
+    }
+
+    char* end;
+    int row = strtol(line, &end, 10);
+    int col = strtol(end, &end, 10);
+    int num = strtol(end, &end, 10);
+    if (end == line)
+    {
+        s->out += "ERROR unknown command\n";
+        return;
+    }
+
+    if (row == 0 && col == 0 && num == 0)                    // Quit works with or without a running game
+    {
+        s->out += "BYE\n";
+        s->closing = true;
+        return;
+    }
+
+    if (s->game == nullptr)
+    {
+        s->out += "ERROR no game, send: new <difficulty> <level>\n";
+        return;
+    }
+
+    int timePassed = duration_cast<seconds>(steady_clock::now() - s->startTime).count();
+    if (timePassed >= timeLimitMinutes(s->game->getDifficulty()) * 60)
+    {
+        s->out += "TIME_UP\n";
+        countEvent(s->game->getDifficultyIndex(), COUNT_TIMEOUTS);
+        endGame(server, s);
+        return;
+    }
+
+    MoveResult result = processMove(s->game, row, col, num);
+    logMoveResult(server.log, s->id, result, row, col, num);
+    switch (result)
+    {
+    case MOVE_ACCEPTED:        s->out += "ACCEPTED\n"; break;
+    case MOVE_UNDONE:          s->out += "UNDONE\n"; break;
+    case MOVE_NOTHING_TO_UNDO: s->out += "NO_UNDO\n"; break;
+    case MOVE_OUT_OF_RANGE:    s->out += "INVALID\n"; break;
+    case MOVE_ORIGINAL_CELL:   s->out += "CLUE\n"; break;
+    case MOVE_MISTAKE:
+        s->out += "MISTAKE " + to_string(s->game->getMistakeCount()) + "\n";
+        break;
+    case MOVE_SOLVED:
+        s->out += "SOLVED " + to_string(timePassed) + "\n";
+        delete s->game;                                      // Already logged as ended
+        s->game = nullptr;
+        break;
+    case MOVE_GAME_OVER:
+        s->out += "GAME_OVER\n";
+        delete s->game;
+        s->game = nullptr;
+        break;
+    case MOVE_QUIT:
+        break;
+    }
+}
+
+bool readFromClient(ServerState& server, Session* s)                              // false - peer closed or read failed
+{
+    char buf[16384];
+    while (true)
+    {
+        ssize_t n = read(s->fd, buf, sizeof(buf));
+        if (n > 0)
+        {
+            s->in.append(buf, n);
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if (n < 0 && errno == EINTR)
+            continue;
+        return false;
+    }
+
+    size_t start = 0, nl;
+    while (!s->closing && (nl = s->in.find('\n', start)) != string::npos)
+    {
+        s->in[nl] = '\0';
+        if (nl > start && s->in[nl - 1] == '\r')
+            s->in[nl - 1] = '\0';
+        handleCommand(server, s, &s->in[start]);
+        start = nl + 1;
+    }
+    s->in.erase(0, start);
+
+    if (s->in.size() > 4096)                                 // No valid command is this long
+        return false;
+    return true;
+}
+
+bool writeToClient(Session* s)                               // false - write failed
+{
+    size_t sent = 0;
+    while (sent < s->out.size())
+    {
+        ssize_t n = write(s->fd, s->out.data() + sent, s->out.size() - sent);
+        if (n > 0)
+            sent += n;
+        else if (n < 0 && errno == EINTR)
+            continue;
+        else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        else
+            return false;
+    }
+    s->out.erase(0, sent);
+    return true;
+}
+
+void collectGames(const vector<Session*>& sessions, const ServerState& server, vector<LoggedGame>& games)
+{
+    auto now = steady_clock::now();
+    for (Session* s : sessions)
+        if (s != nullptr && s->game != nullptr)
+            games.push_back({s->id, s->game, (int)duration_cast<seconds>(now - s->startTime).count()});
+    for (auto& entry : server.detached)
+        games.push_back({entry.first, entry.second->game, (int)duration_cast<seconds>(now - entry.second->startTime).count()});
+}
+
+int runServer(const string& kind, const string& address, const string& logPath = "", int commitIntervalMs = 2)
+{
+    ServerState server;
+    server.nextSessionId = 1;
+    if (!logPath.empty())
+    {
+        vector<LoggedGame> recovered;
+        auto recoveryStart = steady_clock::now();
+        if (!server.log.open(logPath, commitIntervalMs, recovered))
+        {
+            perror("Cannot open move log");
+            return 1;
+        }
+        for (const LoggedGame& g : recovered)
+        {
+            server.detached[g.id] = new Session{-1, g.id, g.game, steady_clock::now() - seconds(g.elapsedSecs), "", "", false, false, false};
+            server.nextSessionId = max(server.nextSessionId, g.id + 1);
+        }
+        cout << "Recovered " << recovered.size() << " games from " << logPath << " in "
+             << duration_cast<milliseconds>(steady_clock::now() - recoveryStart).count() << " ms\n";
+    }
+
+    int listener = openSocket(kind, address, true);
+    if (listener < 0)
+    {
+        perror("Cannot open server socket");
+        return 1;
+    }
+    puzzlePool().start(max(1, (int)thread::hardware_concurrency() - 1), nowNanos());   // For "new <difficulty> 0"
+    int ep = epoll_create1(0);
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.fd = listener;
+    epoll_ctl(ep, EPOLL_CTL_ADD, listener, &ev);
+
+    cout << "Sudoku server listening on " << kind << " " << address << "\n";
+
+    vector<Session*> sessions;                               // Indexed by file descriptor
+    vector<Session*> awaitingCommit;                         // Sessions whose replies wait for the next log commit
+
+    auto closeSession = [&](Session* s)
+    {
+        close(s->fd);                                        // Closing also removes fd from epoll
+        endGame(server, s);
+        if (s->waitingForCommit)
+            awaitingCommit.erase(find(awaitingCommit.begin(), awaitingCommit.end(), s));
+        sessions[s->fd] = nullptr;
+        delete s;
+    };
+    auto flushSession = [&](Session* s)
+    {
+        if (!writeToClient(s) || (s->closing && s->out.empty()))
+        {
+            closeSession(s);
+            return;
+        }
+        bool wantWrite = !s->out.empty();
+        if (wantWrite != s->waitingToWrite)
+        {
+            epoll_event mod{};
+            mod.events = wantWrite ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+            mod.data.fd = s->fd;
+            epoll_ctl(ep, EPOLL_CTL_MOD, s->fd, &mod);
+            s->waitingToWrite = wantWrite;
+        }
+    };
+
+    epoll_event events[512];
+    while (true)
+    {
+        int ready = epoll_wait(ep, events, 512, server.log.msUntilCommit());
+        if (ready < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("epoll_wait");
+            break;
+        }
+
+        for (int e = 0; e < ready; ++e)
+        {
+            int fd = events[e].data.fd;
+            if (fd == listener)
+            {
+                int client;
+                while ((client = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK)) >= 0)
+                {
+                    if (kind != "unix")
+                    {
+                        int one = 1;
+                        setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                    }
+                    if ((size_t)client >= sessions.size())
+                        sessions.resize(client + 1, nullptr);
+                    sessions[client] = new Session{client, server.nextSessionId++, nullptr, steady_clock::now(), "", "", false, false, false};
+                    ev.events = EPOLLIN;
+                    ev.data.fd = client;
+                    epoll_ctl(ep, EPOLL_CTL_ADD, client, &ev);
+                }
+                continue;
+            }
+
+            Session* s = sessions[fd];
+            if (s == nullptr)
+                continue;
+            if ((events[e].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && !readFromClient(server, s))
+            {
+                closeSession(s);
+                continue;
+            }
+            if (server.log.hasPending())
+            {
+                if (!s->waitingForCommit && !s->out.empty())
+                {
+                    s->waitingForCommit = true;
+                    awaitingCommit.push_back(s);
+                }
+            }
+            else if (!s->waitingForCommit)
+                flushSession(s);
+        }
+
+        if (server.log.isOpen() && server.log.msUntilCommit() == 0)
+        {
+            if (!server.log.commit())
+            {
+                perror("Cannot write move log");
+                break;
+            }
+            vector<Session*> committed;
+            committed.swap(awaitingCommit);
+            for (Session* s : committed)
+            {
+                s->waitingForCommit = false;
+                flushSession(s);
+            }
+            if (server.log.needsCheckpoint())
+            {
+                vector<LoggedGame> games;
+                collectGames(sessions, server, games);
+                if (!server.log.checkpoint(games))
+                {
+                    perror("Cannot write checkpoint");
+                    break;
+                }
+            }
+        }
+    }
+    close(ep);
+    close(listener);
+    return 1;
+}
+// ---------------- LOAD GENERATOR ------------------------
+// Opens many connections and pipelines "move, undo" pairs to measure server moves/sec.
+bool findLegalMove(const string& cells, int& row, int& col, int& num)    // false - board is full
+{
+    for (int p = 0; p < 81; ++p)
+    {
+        if (cells[p] != '0')
+            continue;
+        int r = p / 9, c = p % 9;
+        for (int n = 1; n <= 9; ++n)
+        {
+            char d = char('0' + n);
+            bool ok = true;
+            for (int k = 0; k < 9 && ok; ++k)
+                if (cells[r * 9 + k] == d || cells[k * 9 + c] == d ||
+                    cells[(r / 3 * 3 + k / 3) * 9 + c / 3 * 3 + k % 3] == d)
+                    ok = false;
+            if (ok)
+            {
+                row = r + 1;
+                col = c + 1;
+                num = n;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+bool readLines(int fd, int lines, string& last)             // Blocks until that many reply lines arrive
+{
+    char buf[65536];
+    last.clear();
+    while (lines > 0)
+    {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n <= 0)
+            return false;
+        for (ssize_t i = 0; i < n; ++i)
+        {
+            if (buf[i] == '\n')
+            {
+                if (--lines == 0)
+                    break;
+                last.clear();
+            }
+            else
+                last += buf[i];
+        }
+    }
+    return true;
+}
+
+bool writeAll(int fd, const string& data)
+{
+    size_t sent = 0;
+    while (sent < data.size())
+    {
+        ssize_t n = write(fd, data.data() + sent, data.size() - sent);
+        if (n <= 0)
+            return false;
+        sent += n;
+    }
+    return true;
+}
+
+int runLoadGenerator(const string& kind, const string& address, int connections, int durationSecs)
+{
+    const int pairsPerBatch = 32;                            // Pipelined "move" + "undo" pairs per round trip
+    vector<int> fds;
+    vector<string> batches;
+
+    for (int c = 0; c < connections; ++c)
+    {
+        int fd = openSocket(kind, address, false);
+        if (fd < 0)
+        {
+            perror("Cannot connect to server");
+            return 1;
+        }
+        string reply;
+        string cmd = string("new ") + DIFFICULTY_NAMES[c % 3] + " " + to_string(c % 10 + 1) + "\n";
+        if (!writeAll(fd, cmd) || !readLines(fd, 1, reply) || reply.compare(0, 6, "BOARD ") != 0)
+        {
+            cerr << "Unexpected reply: " << reply << "\n";
+            return 1;
+        }
+        int row, col, num;
+        if (!findLegalMove(reply.substr(6), row, col, num))
+        {
+            cerr << "No legal move on board\n";
+            return 1;
+        }
+        string batch;
+        for (int k = 0; k < pairsPerBatch; ++k)
+            batch += to_string(row) + " " + to_string(col) + " " + to_string(num) + "\n-1 -1 -1\n";
+        fds.push_back(fd);
+        batches.push_back(batch);
+    }
+
+    long long moves = 0;
+    auto startTime = steady_clock::now();
+    auto endTime = startTime + seconds(durationSecs);
+    string last;
+    while (steady_clock::now() < endTime)
+    {
+        for (int c = 0; c < connections; ++c)               // Send every batch first so the server sees them together
+            if (!writeAll(fds[c], batches[c]))
+            {
+                perror("write");
+                return 1;
+            }
+        for (int c = 0; c < connections; ++c)
+        {
+            if (!readLines(fds[c], pairsPerBatch * 2, last))
+            {
+                perror("read");
+                return 1;
+            }
+            if (last != "UNDONE")
+            {
+                cerr << "Unexpected reply: " << last << "\n";
+                return 1;
+            }
+        }
+        moves += (long long)connections * pairsPerBatch * 2;
+    }
+    double elapsed = duration_cast<duration<double>>(steady_clock::now() - startTime).count();
+
+    for (int fd : fds)
+    {
+        writeAll(fd, "0 0 0\n");
+        close(fd);
+    }
+    cout << connections << " sessions, " << moves << " moves in " << elapsed << " s = "
+         << (long long)(moves / elapsed) << " moves/sec\n";
+    return 0;
+}
+
+// ---------------- MOVE LOG BENCHMARK --------------------
+// Plays pseudo-random moves on many in-memory games through the move log, then recovers
+// from the files as a restarted server would and checks every game came back identical.
+int runLogBenchmark(const string& path, int sessionCount, int moveCount, int commitIntervalMs)
+{
+    remove(path.c_str());
+    remove((path + ".snap").c_str());
+    vector<Sudoku*> live(sessionCount);
+    long long moves = 0;
+    double playSecs;
+    long long bytesWritten, records, syncs;
+    {
+        MoveLog log;
+        vector<LoggedGame> none;
+        if (!log.open(path, commitIntervalMs, none))
+        {
+            perror("Cannot open move log");
+            return 1;
+        }
+        auto newGame = [&](int i)
+        {
+            live[i] = createGame(DIFFICULTY_NAMES[i % 3], i % 10 + 1);
+            live[i]->getSudoku();
+            log.append(i + 1, LOG_NEW, i % 3, i % 10 + 1);
+        };
+        for (int i = 0; i < sessionCount; ++i)
+            newGame(i);
+
+        unsigned int rng = 12345;                            // Fixed seed, every run plays the same moves
+        auto startTime = steady_clock::now();
+        for (int m = 0; m < moveCount; ++m)
+        {
+            int i = m % sessionCount;
+            rng = rng * 1103515245 + 12345;
+            int pick = (rng >> 16) % 10;
+            int row = -1, col = -1, num = -1;
+            if (pick >= 3 && pick < 9 && !findLegalMove(boardToString(live[i]->getCells()), row, col, num))
+                row = col = num = -1;                        // Board is stuck, undo instead
+            else if (pick == 9)
+            {
+                row = 1 + (rng >> 8) % 9;
+                col = 1 + (rng >> 12) % 9;
+                num = 1 + (rng >> 20) % 9;
+            }
+            MoveResult result = processMove(live[i], row, col, num);
+            logMoveResult(log, i + 1, result, row, col, num);
+            ++moves;
+            if (result == MOVE_SOLVED || result == MOVE_GAME_OVER)
+            {
+                delete live[i];
+                newGame(i);
+            }
+            if (log.msUntilCommit() == 0)
+            {
+                log.commit();
+                if (log.needsCheckpoint())
+                {
+                    vector<LoggedGame> games;
+                    for (int k = 0; k < sessionCount; ++k)
+                        games.push_back({(uint32_t)k + 1, live[k], 0});
+                    log.checkpoint(games);
+                }
+            }
+        }
+        log.commit();
+        playSecs = duration_cast<duration<double>>(steady_clock::now() - startTime).count();
+        bytesWritten = log.bytesWritten;
+        records = log.records;
+        syncs = log.syncs;
+    }                                                        // Log closed here, as if the process had stopped
+
+    MoveLog recoveredLog;
+    vector<LoggedGame> recovered;
+    auto recoveryStart = steady_clock::now();
+    if (!recoveredLog.open(path, commitIntervalMs, recovered))
+    {
+        perror("Cannot recover move log");
+        return 1;
+    }
+    double recoverySecs = duration_cast<duration<double>>(steady_clock::now() - recoveryStart).count();
+
+    int mismatches = (int)recovered.size() != sessionCount;
+    for (const LoggedGame& g : recovered)
+    {
+        Sudoku* original = (g.id >= 1 && g.id <= (uint32_t)sessionCount) ? live[g.id - 1] : nullptr;
+        if (original == nullptr || memcmp(original->getCells(), g.game->getCells(), 81) != 0 ||
+            original->getUndoCell() != g.game->getUndoCell() || original->getUndoValue() != g.game->getUndoValue() ||
+            original->getMistakeCount() != g.game->getMistakeCount())
+            ++mismatches;
+        delete g.game;
+    }
+    for (Sudoku* game : live)
+        delete game;
+
+    cout << moves << " moves on " << sessionCount << " games in " << playSecs << " s ("
+         << (long long)(moves / playSecs) << " moves/sec)\n";
+    cout << records << " log records, " << syncs << " syncs (" << (double)moves / max(syncs, 1LL) << " moves per sync)\n";
+    cout << bytesWritten << " bytes written = " << (double)bytesWritten / moves << " bytes per move, write amplification "
+         << (double)bytesWritten / (records * LOG_RECORD_BYTES) << "x over raw records\n";
+    cout << "Recovery of " << recovered.size() << " games took " << recoverySecs * 1000 << " ms, "
+         << (mismatches ? "MISMATCH" : "all games identical") << "\n";
+    return mismatches ? 1 : 0;
+}
+#endif
+
+// ---------------- SOLVE SERVICE -------------------------
+// One solver daemon for every local tool. --solve-service NAME puts a block of POSIX shared
+// memory at /NAME and solves the boards clients leave in it. Each client claims a channel: a
+// single-producer/single-consumer ring of requests (client to daemon) and one of responses (daemon
+// to client). A ring slot is one cache line carrying the board in the packed cell format of
+// SAVE AND RESUME, and both sides fill and read slots in place, so nothing is copied through the
+// kernel. Head and tail counters sit on cache lines of their own, and each side keeps a private
+// copy of the other side's counter, refreshed only when its ring looks full.
+// A side with nothing to do spins for a while (yielding its core after the first few polls, so the
+// other side gets to run on a machine with few cores), then sleeps on a futex. The other side
+// makes the wake-up call only after seeing it asleep, so while both are busy a solve costs no
+// system call.
+// Worker w of the daemon serves channels w, w + workers, ... and channels are claimed lowest
+// first, so the first clients each get a worker of their own. Only classic 9x9 boards are served.
+#ifdef __linux__
+const uint32_t SERVICE_MAGIC = 0x31534B53;                   // "SKS1"
+const int SERVICE_CHANNELS = 16;
+const uint32_t SERVICE_RING_SLOTS = 256;                     // Power of two, counters wrap around
+const int MAX_SERVICE_WORKERS = 16;
+const int SERVICE_PAUSES = 256;                              // Empty polls before a side starts yielding its core
+const int SERVICE_SPINS = 1 << 14;                           // ...and before it goes to sleep
+const int SERVICE_NAP_MS = 100;                              // Longest sleep, so shutdown and dead peers get noticed
+const uint8_t SERVICE_MALFORMED = 3;                         // Response status past SolveStatus: a cell was not 0-9
+const uint8_t SERVICE_UNRATED = 3;                           // Response rating past HARD
+
+struct ServiceRequest                                        // One cache line
+{
+    uint64_t tag;                                            // Returned unchanged in the response
+    uint32_t limitMicros;                                    // Time allowed for the solve, 0 - no limit
+    uint8_t limit;                                           // Solutions to look for: 1, or 2 to learn whether it is unique
+    uint8_t cells[PACKED_CELL_BYTES];
+    uint8_t unused[10];
+};
+
+struct ServiceResponse                                       // One cache line
+{
+    uint64_t tag;
+    uint32_t solveNanos;                                     // Saturates at about 4.3 s
+    uint8_t solutions;                                       // Found, at most the limit asked for
+    uint8_t status;                                          // SolveStatus or SERVICE_MALFORMED
+    uint8_t rating;                                          // Difficulty as in --batch when a limit 2 solve found one solution, else SERVICE_UNRATED
+    uint8_t solution[PACKED_CELL_BYTES];                     // First solution found, when there is one
+    uint8_t unused[8];
+};
+static_assert(sizeof(ServiceRequest) == 64 && sizeof(ServiceResponse) == 64, "ring slots are one cache line");
+static_assert(sizeof(atomic<uint32_t>) == sizeof(uint32_t) && ATOMIC_INT_LOCK_FREE == 2, "futexes need plain 32 bit atomics");
+
+struct ServiceChannel
+{
+    alignas(64) atomic<uint32_t> owner;                      // Client pid, 0 - free
+    atomic<uint32_t> clientAsleep;                           // 1 - the client waits on the responseTail futex
+    alignas(64) atomic<uint32_t> requestTail;                // Written by the client only
+    alignas(64) atomic<uint32_t> requestHead;                // ...by the daemon only
+    alignas(64) atomic<uint32_t> responseTail;               // ...by the daemon only
+    alignas(64) atomic<uint32_t> responseHead;               // ...by the client only
+    ServiceRequest requests[SERVICE_RING_SLOTS];
+    ServiceResponse responses[SERVICE_RING_SLOTS];
+};
+
+struct ServiceWorkerState
+{
+    alignas(64) atomic<uint32_t> doorbell;                   // Futex a sleeping worker waits on, bumped to wake it
+    atomic<uint32_t> asleep;
+};
+
+struct ServiceHeader                                         // The whole shared block
+{
+    atomic<uint32_t> magic;                                  // SERVICE_MAGIC once the daemon has set the block up
+    uint32_t daemonPid;
+    uint32_t workers;
+    ServiceWorkerState workerStates[MAX_SERVICE_WORKERS];
+    ServiceChannel channels[SERVICE_CHANNELS];
+};
+
+string serviceShmName(const string& name)
+{
+    return (!name.empty() && name[0] == '/') ? name : "/" + name;
+}
+
+bool processAlive(uint32_t pid)
+{
+    return pid != 0 && (kill((pid_t)pid, 0) == 0 || errno == EPERM);
+}
+
+inline void cpuRelax(int spins)                              // Polls without an answer so far
+{
+    if (spins >= SERVICE_PAUSES)
+    {
+        this_thread::yield();
+        return;
+    }
+#ifdef __SSE2__
+    _mm_pause();
+#endif
+}
+
+void futexWait(atomic<uint32_t>& word, uint32_t expected, int timeoutMs)   // Returns at once when word != expected
+{
+    timespec timeout = {timeoutMs / 1000, (timeoutMs % 1000) * 1000000L};
+    syscall(SYS_futex, (uint32_t*)&word, FUTEX_WAIT, expected, &timeout, nullptr, 0);   // Not FUTEX_PRIVATE: shared between processes
+}
+
+void futexWake(atomic<uint32_t>& word)
+{
+    syscall(SYS_futex, (uint32_t*)&word, FUTEX_WAKE, INT32_MAX, nullptr, nullptr, 0);
+}
+
+void serviceSolve(const ServiceRequest& request, ServiceResponse& response)
+{
+    unsigned char puzzle[81], solution[81];
+    response.tag = request.tag;
+    response.solveNanos = 0;
+    response.solutions = 0;
+    response.rating = SERVICE_UNRATED;
+    if (!unpackCells(request.cells, puzzle))
+    {
+        response.status = SERVICE_MALFORMED;
+        return;
+    }
+    uint64_t start = nowNanos();
+    Deadline deadline = {request.limitMicros == 0 ? 0 : start + request.limitMicros * 1000ULL, nullptr};
+    Bounded<BatchStats> stats(deadline);
+    int limit = request.limit >= 2 ? 2 : 1;
+    int found = solveBoardTraced(puzzle, solution, limit, stats);
+    response.solveNanos = (uint32_t)min<uint64_t>(nowNanos() - start, UINT32_MAX);
+    response.solutions = (uint8_t)found;
+    response.status = (uint8_t)stats.status;
+    if (limit == 2 && found == 1 && stats.status == SOLVE_COMPLETE)
+        response.rating = (uint8_t)searchDifficulty(stats);
+    if (found > 0)
+        packCells(solution, response.solution);
+}
+
+// Solves the channel's waiting requests, as many as its response ring has room for.
+int serveChannel(ServiceChannel& channel, uint32_t& responseHeadSeen)
+{
+    uint32_t head = channel.requestHead.load(memory_order_relaxed);
+    uint32_t tail = channel.requestTail.load(memory_order_acquire);
+    uint32_t out = channel.responseTail.load(memory_order_relaxed);
+    int served = 0;
+    for (; head != tail; ++head, ++out, ++served)
+    {
+        if (out - responseHeadSeen == SERVICE_RING_SLOTS)
+        {
+            responseHeadSeen = channel.responseHead.load(memory_order_acquire);
+            if (out - responseHeadSeen == SERVICE_RING_SLOTS)
+                break;                                       // The client is behind on its responses
+        }
+        serviceSolve(channel.requests[head % SERVICE_RING_SLOTS], channel.responses[out % SERVICE_RING_SLOTS]);
+        channel.responseTail.store(out + 1, memory_order_release);   // Before requestHead, see SolveServiceClient::connect
+        channel.requestHead.store(head + 1, memory_order_release);
+        atomic_thread_fence(memory_order_seq_cst);           // Publish before looking for a sleeping client
+        if (channel.clientAsleep.load(memory_order_relaxed) != 0)
+            futexWake(channel.responseTail);
+    }
+    return served;
+}
+
+bool workerHasWork(ServiceHeader* header, int w)
+{
+    for (int c = w; c < SERVICE_CHANNELS; c += header->workers)
+    {
+        ServiceChannel& channel = header->channels[c];
+        uint32_t out = channel.responseTail.load(memory_order_relaxed);
+        if (channel.requestHead.load(memory_order_relaxed) != channel.requestTail.load(memory_order_relaxed) &&
+            out - channel.responseHead.load(memory_order_relaxed) < SERVICE_RING_SLOTS)
+            return true;
+    }
+    return false;
+}
+
+atomic<bool> serviceStopping(false);
+
+void stopSolveService(int)
+{
+    serviceStopping.store(true);
+}
+
+void runServiceWorker(ServiceHeader* header, int w, atomic<long long>& served)
+{
+    ServiceWorkerState& state = header->workerStates[w];
+    uint32_t responseHeadSeen[SERVICE_CHANNELS] = {};
+    long long count = 0;
+    int idle = 0;
+    while (!serviceStopping.load(memory_order_relaxed))
+    {
+        int done = 0;
+        for (int c = w; c < SERVICE_CHANNELS; c += header->workers)
+            done += serveChannel(header->channels[c], responseHeadSeen[c]);
+        count += done;
+        if (done > 0 || ++idle < SERVICE_SPINS)
+        {
+            if (done == 0)
+                cpuRelax(idle);
+            else
+                idle = 0;
+            continue;
+        }
+        uint32_t ring = state.doorbell.load(memory_order_acquire);
+        state.asleep.store(1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst);           // Say so before the last look at the rings
+        if (!workerHasWork(header, w))
+            futexWait(state.doorbell, ring, SERVICE_NAP_MS);
+        state.asleep.store(0, memory_order_relaxed);
+        idle = 0;
+    }
+    served += count;
+}
+
+int runSolveService(const string& name, int workers)
+{
+    workers = max(1, min(workers, MAX_SERVICE_WORKERS));
+    string path = serviceShmName(name);
+    int fd = shm_open(path.c_str(), O_RDONLY, 0);
+    if (fd >= 0)                                             // Refuse to replace a daemon that is still serving
+    {
+        void* old = mmap(nullptr, sizeof(ServiceHeader), PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        bool running = false;
+        if (old != MAP_FAILED)
+        {
+            ServiceHeader* h = (ServiceHeader*)old;
+            running = h->magic.load(memory_order_acquire) == SERVICE_MAGIC && processAlive(h->daemonPid);
+            munmap(old, sizeof(ServiceHeader));
+        }
+        if (running)
+        {
+            cout << "A solve service is already running at " << path << "\n";
+            return 1;
+        }
+    }
+    shm_unlink(path.c_str());                                // Left behind by a daemon that was killed
+    fd = shm_open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0 || ftruncate(fd, sizeof(ServiceHeader)) != 0)
+    {
+        perror("Cannot create shared memory");
+        return 1;
+    }
+    void* block = mmap(nullptr, sizeof(ServiceHeader), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (block == MAP_FAILED)
+    {
+        perror("mmap");
+        shm_unlink(path.c_str());
+        return 1;
+    }
+    ServiceHeader* header = new (block) ServiceHeader();
+    header->daemonPid = (uint32_t)getpid();
+    header->workers = (uint32_t)workers;
+    header->magic.store(SERVICE_MAGIC, memory_order_release);
+    signal(SIGINT, stopSolveService);
+    signal(SIGTERM, stopSolveService);
+    cout << "Solve service at " << path << ": " << workers << " workers, " << SERVICE_CHANNELS << " channels of "
+         << SERVICE_RING_SLOTS << " slots, " << sizeof(ServiceHeader) / 1024 << " KB" << endl;
+
+    atomic<long long> served(0);
+    vector<thread> threads;
+    for (int w = 0; w < workers; ++w)
+        threads.emplace_back(runServiceWorker, header, w, ref(served));
+    for (thread& t : threads)
+        t.join();
+
+    header->magic.store(0, memory_order_release);            // Waiting clients see the daemon gone
+    shm_unlink(path.c_str());
+    munmap(block, sizeof(ServiceHeader));
+    cout << "Solve service stopped after " << served.load() << " solves\n";
+    return 0;
+}
+
+// Client side. Requests are filled in place: reserve() hands out the next free request slot,
+// submit() passes every reserved slot to the daemon at once. poll() returns the next response,
+// or nullptr if none has arrived; wait() blocks for it. A response stays valid until release().
+// Without a connection reserve(), poll() and wait() return nullptr and solve() returns -1.
+// One client per thread; a process may hold up to SERVICE_CHANNELS of them.
+class SolveServiceClient
+{
+    ServiceHeader* header;
+    ServiceChannel* channel;
+    int channelIndex;
+    uint32_t requestTail, requestHeadSeen;                   // Next request to submit, and the daemon's progress as last seen
+    uint32_t reserved;                                       // Slots handed out by reserve() since the last submit()
+    uint32_t responseHead, responseTailSeen;
+public:
+    SolveServiceClient() : header(nullptr), channel(nullptr), channelIndex(-1), requestTail(0), requestHeadSeen(0),
+                           reserved(0), responseHead(0), responseTailSeen(0) {};
+    SolveServiceClient(const SolveServiceClient&) = delete;
+    SolveServiceClient& operator=(const SolveServiceClient&) = delete;
+    ~SolveServiceClient() { disconnect(); }
+
+    bool connect(const string& name, string& error)
+    {
+        string path = serviceShmName(name);
+        int fd = shm_open(path.c_str(), O_RDWR, 0);
+        struct stat info;
+        if (fd < 0 || fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(ServiceHeader))
+        {
+            if (fd >= 0) close(fd);
+            error = "no solve service at " + path;
+            return false;
+        }
+        void* block = mmap(nullptr, sizeof(ServiceHeader), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+        close(fd);
+        if (block == MAP_FAILED)
+        {
+            error = "cannot map " + path;
+            return false;
+        }
+        header = (ServiceHeader*)block;
+        if (header->magic.load(memory_order_acquire) != SERVICE_MAGIC || !processAlive(header->daemonPid))
+        {
+            disconnect();
+            error = "the solve service at " + path + " is not running";
+            return false;
+        }
+
+        uint32_t pid = (uint32_t)getpid();
+        for (int c = 0; c < SERVICE_CHANNELS; ++c)
+        {
+            ServiceChannel& ch = header->channels[c];
+            uint32_t owner = ch.owner.load(memory_order_acquire);
+            if ((owner != 0 && processAlive(owner)) || !ch.owner.compare_exchange_strong(owner, pid))
+                continue;
+            // Pick up where the last owner stopped: its requests finish and their responses are dropped.
+            // The daemon moves responseTail before requestHead, so once it has taken every request
+            // all their responses are in.
+            requestTail = ch.requestTail.load(memory_order_relaxed);
+            for (long long spins = 1; ch.requestHead.load(memory_order_acquire) != requestTail; ++spins)
+            {
+                ch.responseHead.store(ch.responseTail.load(memory_order_acquire), memory_order_release);
+                cpuRelax(SERVICE_PAUSES);
+                if (spins % SERVICE_SPINS == 0 && !processAlive(header->daemonPid))
+                {
+                    ch.owner.store(0, memory_order_release);
+                    disconnect();
+                    error = "the solve service at " + path + " stopped";
+                    return false;
+                }
+            }
+            responseHead = responseTailSeen = ch.responseTail.load(memory_order_acquire);
+            ch.responseHead.store(responseHead, memory_order_release);
+            ch.clientAsleep.store(0, memory_order_relaxed);
+            requestHeadSeen = requestTail;
+            reserved = 0;
+            channel = &ch;
+            channelIndex = c;
+            return true;
+        }
+        disconnect();
+        error = "all " + to_string(SERVICE_CHANNELS) + " channels of " + path + " are taken";
+        return false;
+    }
+
+    void disconnect()                                        // Requests in flight are dropped
+    {
+        if (channel != nullptr)
+            channel->owner.store(0, memory_order_release);
+        if (header != nullptr)
+            munmap(header, sizeof(ServiceHeader));
+        header = nullptr;
+        channel = nullptr;
+        channelIndex = -1;
+        requestTail = requestHeadSeen = reserved = responseHead = responseTailSeen = 0;   // Nothing in flight any more
+    }
+
+    bool connected() const { return channel != nullptr; }
+    uint32_t inFlight() const { return requestTail - responseHead; }   // Submitted, response not released yet
+
+    ServiceRequest* reserve()                                // nullptr - request ring full, or not connected
+    {
+        if (!connected())
+            return nullptr;
+        uint32_t next = requestTail + reserved;
+        if (next - requestHeadSeen == SERVICE_RING_SLOTS)
+        {
+            requestHeadSeen = channel->requestHead.load(memory_order_acquire);
+            if (next - requestHeadSeen == SERVICE_RING_SLOTS)
+                return nullptr;
+        }
+        ++reserved;
+        return &channel->requests[next % SERVICE_RING_SLOTS];
+    }
+
+    void submit()
+    {
+        if (reserved == 0)
+            return;
+        requestTail += reserved;
+        reserved = 0;
+        channel->requestTail.store(requestTail, memory_order_release);
+        atomic_thread_fence(memory_order_seq_cst);           // Publish before looking for a sleeping worker
+        ServiceWorkerState& worker = header->workerStates[channelIndex % header->workers];
+        if (worker.asleep.load(memory_order_relaxed) != 0)
+        {
+            worker.doorbell.fetch_add(1, memory_order_relaxed);
+            futexWake(worker.doorbell);
+        }
+    }
+
+    const ServiceResponse* poll()                            // nullptr - no response yet, or not connected
+    {
+        if (!connected())
+            return nullptr;
+        if (responseHead == responseTailSeen)
+        {
+            responseTailSeen = channel->responseTail.load(memory_order_acquire);
+            if (responseHead == responseTailSeen)
+                return nullptr;
+        }
+        return &channel->responses[responseHead % SERVICE_RING_SLOTS];
+    }
+
+    const ServiceResponse* wait()                            // nullptr - nothing in flight, or the daemon is gone
+    {
+        for (int spins = 0; inFlight() > 0; ++spins)
+        {
+            const ServiceResponse* response = poll();
+            if (response != nullptr)
+                return response;
+            if (spins < SERVICE_SPINS)
+            {
+                cpuRelax(spins);
+                continue;
+            }
+            channel->clientAsleep.store(1, memory_order_relaxed);
+            atomic_thread_fence(memory_order_seq_cst);       // Say so before the last look at the ring
+            uint32_t tail = channel->responseTail.load(memory_order_relaxed);
+            if (tail == responseHead)
+                futexWait(channel->responseTail, tail, SERVICE_NAP_MS);
+            channel->clientAsleep.store(0, memory_order_relaxed);
+            if (header->magic.load(memory_order_acquire) != SERVICE_MAGIC || !processAlive(header->daemonPid))
+                return poll();
+            spins = 0;
+        }
+        return nullptr;
+    }
+
+    void release()                                           // Done with the response poll() or wait() returned
+    {
+        channel->responseHead.store(++responseHead, memory_order_release);
+    }
+
+    // Solves one board the way solveBoard() does; -1 - the daemon is gone. Use with nothing else in flight.
+    int solve(const unsigned char* puzzle, unsigned char* solution = nullptr, int limit = 1)
+    {
+        ServiceRequest* request = reserve();
+        if (request == nullptr)
+            return -1;
+        request->tag = 0;
+        request->limitMicros = 0;
+        request->limit = (uint8_t)limit;
+        packCells(puzzle, request->cells);
+        submit();
+        const ServiceResponse* response = wait();
+        if (response == nullptr)
+            return -1;
+        int found = response->solutions;
+        if (found > 0 && solution != nullptr)
+            unpackCells(response->solution, solution);
+        release();
+        return found;
+    }
+};
+
+// --bench-service solves a puzzle file in process and through a running daemon, with the same
+// number of threads and each service client keeping its ring full, and checks every answer agrees.
+// Then it times one-at-a-time round trips on solved boards, where the solve itself is nearly free.
+int runServiceBenchmark(const string& name, const string& path, int clients)
+{
+    clients = max(1, min(clients, SERVICE_CHANNELS));
+    vector<unsigned char> puzzles;
+    long long skipped = 0;
+    string error;
+    if (!forEachPuzzle(path, [&](const unsigned char* cells, long long, const Variant& variant)
+    {
+        if (strcmp(variant.name, "classic") == 0)
+            puzzles.insert(puzzles.end(), cells, cells + 81);
+        else
+            ++skipped;
+        return true;
+    }, error))
+    {
+        cout << path << ": " << error << "\n";
+        return 1;
+    }
+    long long count = puzzles.size() / 81;
+    if (count == 0)
+    {
+        cout << path << ": no classic puzzles\n";
+        return 1;
+    }
+    SolveServiceClient probe;
+    if (!probe.connect(name, error))
+    {
+        cout << error << "\n";
+        return 1;
+    }
+    probe.disconnect();
+
+    vector<unsigned char> solutions(count * 81, 0);
+    vector<int> found(count);
+    auto runThreads = [&](auto body)
+    {
+        auto startTime = steady_clock::now();
+        vector<thread> threads;
+        for (int t = 0; t < clients; ++t)
+            threads.emplace_back(body, t);
+        for (thread& t : threads)
+            t.join();
+        return duration_cast<duration<double>>(steady_clock::now() - startTime).count();
+    };
+
+    double localSecs = runThreads([&](int t)
+    {
+        for (long long i = t; i < count; i += clients)
+            found[i] = solveBoard(&puzzles[i * 81], &solutions[i * 81], 2);
+    });
+
+    atomic<long long> mismatches(0), failures(0);
+    double serviceSecs = runThreads([&](int t)
+    {
+        SolveServiceClient client;
+        string reason;
+        if (!client.connect(name, reason))
+        {
+            ++failures;
+            return;
+        }
+        unsigned char solution[81];
+        long long next = t;
+        while (next < count || client.inFlight() > 0)
+        {
+            ServiceRequest* request;
+            while (next < count && (request = client.reserve()) != nullptr)
+            {
+                request->tag = (uint64_t)next;
+                request->limitMicros = 0;
+                request->limit = 2;
+                packCells(&puzzles[next * 81], request->cells);
+                next += clients;
+            }
+            client.submit();
+            const ServiceResponse* response = client.wait();
+            if (response == nullptr)
+            {
+                ++failures;
+                return;
+            }
+            do
+            {
+                long long i = (long long)response->tag;
+                if (response->solutions != found[i] ||
+                    (found[i] > 0 && (!unpackCells(response->solution, solution) || memcmp(solution, &solutions[i * 81], 81) != 0)))
+                    ++mismatches;
+                client.release();
+            } while ((response = client.poll()) != nullptr);
+        }
+    });
+
+    const int roundTrips = 20000;
+    vector<uint64_t> remote(roundTrips), local(roundTrips);
+    SolveServiceClient client;
+    if (!client.connect(name, error))                        // Channels all taken, or the daemon stopped since
+    {
+        cout << error << "\n";
+        return 1;
+    }
+    unsigned char solution[81];
+    for (int k = 0; k < roundTrips && failures == 0; ++k)
+    {
+        const unsigned char* board = &solutions[(k % count) * 81];
+        uint64_t start = nowNanos();
+        failures += client.solve(board, solution) < 0;
+        uint64_t middle = nowNanos();
+        solveBoard(board, solution);
+        local[k] = nowNanos() - middle;
+        remote[k] = middle - start;
+    }
+    sort(remote.begin(), remote.end());
+    sort(local.begin(), local.end());
+
+    cout << count << " puzzles" << (skipped > 0 ? " (" + to_string(skipped) + " not classic, skipped)" : string())
+         << ", " << clients << (clients == 1 ? " thread" : " threads") << "\n";
+    cout << "  in process:    " << (long long)(count / localSecs) << " puzzles/sec\n";
+    cout << "  solve service: " << (long long)(count / serviceSecs) << " puzzles/sec (" << (int)(localSecs / serviceSecs * 100)
+         << "% of in process), " << mismatches.load() << " answers differ\n";
+    cout << "Round trip for a solved board: median " << remote[roundTrips / 2] << " ns, p99 " << remote[roundTrips * 99 / 100]
+         << " ns (in process median " << local[roundTrips / 2] << " ns)\n";
+    if (failures > 0)
+        cout << failures.load() << " clients lost the service\n";
+    return (mismatches > 0 || failures > 0) ? 1 : 0;
+}
+#endif
+
+// ---------------- ALLOCATION BENCHMARK ------------------
+// Creates and deletes games and solves every shipped puzzle, then reports how often
+// the game pool and the solver arena had to go to malloc.
+int runPoolBenchmark(int gameCount, int solveCount)
+{
+    long long slabsBefore = gamePool.slabMallocs;
+    auto startTime = steady_clock::now();
+    for (int i = 0; i < gameCount; ++i)
+    {
+        Sudoku* game = createGame(DIFFICULTY_NAMES[i % 3], i % 10 + 1);
+        game->getSudoku();
+        delete game;
+    }
+    double gameSecs = duration_cast<duration<double>>(steady_clock::now() - startTime).count();
+    long long gameMallocs = gamePool.slabMallocs - slabsBefore;
+
+    vector<Sudoku*> catalog;                                 // All 30 shipped puzzles
+    for (int d = 0; d < 3; ++d)
+        for (int lvl = 1; lvl <= 10; ++lvl)
+        {
+            catalog.push_back(createGame(DIFFICULTY_NAMES[d], lvl));
+            catalog.back()->getSudoku();
+        }
+
+    long long chunksBefore = searchArena.chunkMallocs;
+    int solved = 0;
+    unsigned char solution[81];
+    startTime = steady_clock::now();
+    for (int i = 0; i < solveCount; ++i)
+        solved += solveBoard(catalog[i % catalog.size()]->getCells(), solution) == 1;
+    double solveSecs = duration_cast<duration<double>>(steady_clock::now() - startTime).count();
+    long long solveMallocs = searchArena.chunkMallocs - chunksBefore;
+
+    for (Sudoku* game : catalog)
+        delete game;
+
+    cout << gameCount << " games created and deleted in " << gameSecs * 1000 << " ms, "
+         << gameMallocs << " mallocs (" << (double)gameMallocs / max(gameCount, 1) << " per game)\n";
+    cout << solveCount << " solves (" << solved << " solved) in " << solveSecs * 1000 << " ms, "
+         << solveMallocs << " mallocs (" << (double)solveMallocs / max(solveCount, 1) << " per solve)\n";
+    return 0;
+}
+
+// ---------------- PENCIL MARK BENCHMARK -----------------
+// Times makeMove + undoMove with auto pencil marks off and on, then plays a random walk of
+// moves, overwrites and undos, comparing the marks after every step with candidates(). Auto marks
+// are switched on partway through, so undos also take the path without a marks journal.
+int runPencilBenchmark(int pairs)
+{
+    vector<Sudoku*> catalog;                                 // All 30 shipped puzzles
+    vector<vector<pair<int, int>>> legal;                    // Cell and digit of every move valid on each start board
+    for (int d = 0; d < 3; ++d)
+        for (int lvl = 1; lvl <= 10; ++lvl)
+        {
+            Sudoku* game = createGame(DIFFICULTY_NAMES[d], lvl);
+            game->getSudoku();
+            legal.emplace_back();
+            for (int p = 0; p < 81; ++p)
+                for (int num = 1; num <= 9; ++num)
+                    if (game->isValidMove(p / 9, p % 9, num))
+                        legal.back().push_back({p, num});
+            if (legal.back().empty())
+            {
+                delete game;
+                legal.pop_back();
+                continue;
+            }
+            catalog.push_back(game);
+        }
+    pairs = max(pairs, 1);
+
+    double nanos[2];
+    for (int mode = 0; mode < 2; ++mode)
+    {
+        for (Sudoku* game : catalog)
+            game->setPencilMode(mode == 0 ? PENCIL_OFF : PENCIL_AUTO);
+        uint64_t start = nowNanos();
+        for (int i = 0; i < pairs; ++i)
+        {
+            size_t g = i % catalog.size();
+            const pair<int, int>& move = legal[g][(i / catalog.size()) % legal[g].size()];
+            catalog[g]->makeMove(move.first / 9 + 1, move.first % 9 + 1, move.second);
+            catalog[g]->undoMove();
+        }
+        nanos[mode] = (double)(nowNanos() - start) / pairs;
+    }
+    cout << pairs << " makeMove + undoMove pairs: " << nanos[0] << " ns without pencil marks, " << nanos[1]
+         << " ns with auto marks, " << (nanos[1] - nanos[0]) / 2 << " ns per marks update\n";
+
+    Rng rng(1);
+    long long steps = 0, wrong = 0, switchedOn = 0;
+    for (Sudoku* game : catalog)
+    {
+        game->setPencilMode(PENCIL_OFF);
+        game->getSudoku();                                   // Back to the clues
+        for (int i = 0; i < 2000; ++i)
+        {
+            if (i % 400 == 0)                                // Marks off for a while: the moves made meanwhile, overwrites
+                game->setPencilMode(PENCIL_OFF);             // included, are undone without a marks journal
+            else if (i % 400 == 200)
+            {
+                game->setPencilMode(PENCIL_AUTO);
+                ++switchedOn;
+            }
+            if (rng.next() % 4 == 0 || i % 400 == 200)
+                game->undoMove();
+            else
+            {
+                int p = (int)(rng.next() % 81);
+                game->makeMove(p / 9 + 1, p % 9 + 1, 1 + (int)(rng.next() % 9));   // Also overwrites earlier moves
+            }
+            if (game->getPencilMarks() == nullptr)
+                continue;
+            ++steps;
+            for (int p = 0; p < 81; ++p)
+                wrong += game->getPencilMarks()->at(p) != game->candidates(p);
+        }
+        delete game;
+    }
+    cout << steps << " random moves and undos with auto marks, switched on " << switchedOn << " times mid-game: "
+         << wrong << " cells differ from candidates()\n";
+    return wrong == 0 ? 0 : 1;
+}
+
+// ---------------- BRANCH BENCHMARK ----------------------
+// Plays random moves, undos, forks and branch switches on every shipped puzzle and checks each
+// board against a model that copies the whole board per branch, then times fork and switch.
+// Auto pencil marks are on throughout and checked against candidates() after every undo and switch.
+int runBranchBenchmark(int operations)
+{
+    struct ModelBranch
+    {
+        unsigned char cells[81];
+        vector<pair<int, int>> undo;                         // Cell and value before, of every move still on the branch
+    };
+    Rng rng(3);
+    long long checks = 0, wrong = 0, wrongMarks = 0, moves = 0, forks = 0, switches = 0, switchedMoves = 0;
+    uint64_t forkNanos = 0, switchNanos = 0;
+    size_t treeBytes = 0;
+    operations = max(operations, 1);
+    for (int d = 0; d < 3; ++d)
+        for (int lvl = 1; lvl <= 10; ++lvl)
+        {
+            Sudoku* game = createGame(DIFFICULTY_NAMES[d], lvl);
+            game->getSudoku();
+            game->setPencilMode(PENCIL_AUTO);
+            vector<ModelBranch> model(1);
+            memcpy(model[0].cells, game->getCells(), 81);
+            int branch = 1;
+            for (int i = 0; i < operations; ++i)
+            {
+                int op = (int)(rng.next() % 20);
+                ModelBranch& m = model[branch - 1];
+                if (op < 12)
+                {
+                    int p = (int)(rng.next() % 81), num = 1 + (int)(rng.next() % 9);
+                    if (game->makeMove(p / 9 + 1, p % 9 + 1, num))
+                    {
+                        if (game->getMoveTree() == nullptr)  // Before the first fork only the last move can be undone
+                            m.undo.clear();
+                        m.undo.push_back({p, m.cells[p]});
+                        m.cells[p] = (unsigned char)num;
+                        ++moves;
+                    }
+                }
+                else if (op < 16)
+                {
+                    bool undone = game->undoMove();
+                    wrong += undone == m.undo.empty();
+                    if (undone && !m.undo.empty())
+                    {
+                        m.cells[m.undo.back().first] = (unsigned char)m.undo.back().second;
+                        m.undo.pop_back();
+                    }
+                }
+                else if (op < 17)
+                {
+                    model.push_back(m);
+                    uint64_t start = nowNanos();
+                    branch = game->fork();
+                    forkNanos += nowNanos() - start;
+                    ++forks;
+                    wrong += branch != (int)model.size();
+                }
+                else
+                {
+                    int target = 1 + (int)(rng.next() % model.size());
+                    int before = game->getMoveTree() != nullptr ? game->getMoveTree()->depth() : 0;
+                    uint64_t start = nowNanos();
+                    wrong += !game->switchBranch(target);
+                    switchNanos += nowNanos() - start;
+                    if (game->getMoveTree() != nullptr)
+                        switchedMoves += before + game->getMoveTree()->depth();   // At most, the common part is not replayed
+                    ++switches;
+                    branch = target;
+                }
+                ++checks;
+                wrong += memcmp(game->getCells(), model[branch - 1].cells, 81) != 0 || game->getBranch() != branch;
+                if (op >= 12 && op != 16)                    // After an undo or a switch
+                    for (int p = 0; p < 81; ++p)
+                        wrongMarks += game->getPencilMarks()->at(p) != game->candidates(p);
+            }
+            if (game->getMoveTree() != nullptr)
+                treeBytes += game->getMoveTree()->bytes();
+            delete game;
+        }
+    cout << checks << " operations on 30 games, " << moves << " moves, " << forks << " forks, " << switches << " switches: "
+         << wrong << " boards differ from the model, " << wrongMarks << " pencil mark cells differ from candidates()\n";
+    cout << "fork " << (double)forkNanos / max(forks, 1LL) << " ns, switch " << (double)switchNanos / max(switches, 1LL)
+         << " ns (at most " << (double)switchedMoves / max(switches, 1LL) << " moves replayed), tree "
+         << (double)treeBytes / max(moves, 1LL) << " bytes per move made\n";
+    return (wrong == 0 && wrongMarks == 0) ? 0 : 1;
+}
+
+// ---------------- SOLVER TRACE --------------------------
+// Solves one shipped puzzle with search statistics, optionally writing a Chrome trace.
+int runTraceSolve(const string& diff, int lvl, const string& tracePath, int sampleEvery)
+{
+    Sudoku* game = createGame(diff, lvl);
+    if (game == nullptr)
+    {
+        cout << "Invalid difficulty or level.\n";
+        return 1;
+    }
+    game->getSudoku();
+    unsigned char solution[81];
+    ChromeTrace trace(sampleEvery);
+    int found = solveBoardTraced(game->getCells(), solution, 2, trace);      // Limit 2 also proves uniqueness
+    delete game;
+
+    cout << diff << " level " << lvl << ": " << (found == 0 ? "no solution" : found == 1 ? "unique solution" : "several solutions") << "\n";
+    trace.print(cout);
+    if (!tracePath.empty())
+    {
+        if (!trace.write(tracePath))
+        {
+            cout << "Cannot write " << tracePath << "\n";
+            return 1;
+        }
+        cout << "Chrome trace written to " << tracePath << "\n";
+    }
+    return 0;
+}
+
+// ---------------- ALLOCATION CHECKS ---------------------
+// Runs each hot path once to warm pools, catalogs and metrics, then again while counting
+// heap allocations. Any path above its limit fails the run (exit code 1).
+template <typename Path>
+void countAllocations(Path path, long long& allocations, long long& bytes)
+{
+    long long allocationsBefore = heapAllocations, bytesBefore = heapBytes;
+    path();
+    allocations = heapAllocations - allocationsBefore;
+    bytes = heapBytes - bytesBefore;
+}
+
+bool replayToSolution(int diff, int lvl)                     // Plays a whole game to the solved state
+{
+    Sudoku* game = createGame(DIFFICULTY_NAMES[diff], lvl);
+    game->getSudoku();
+    unsigned char solution[81];
+    bool solved = false;
+    if (solveBoard(game->getCells(), solution) == 1)
+    {
+        for (int p = 0; p < 81; ++p)
+            if (game->getCells()[p] == 0)
+            {
+                processMove(game, p / 9 + 1, p % 9 + 1, solution[p]);
+                processMove(game, -1, -1, -1);               // Undo and play it again
+                solved = processMove(game, p / 9 + 1, p % 9 + 1, solution[p]) == MOVE_SOLVED;
+            }
+    }
+    delete game;
+    return solved;
+}
+
+int runAllocationChecks()
+{
+    struct Check
+    {
+        const char* name;
+        long long limit;
+        function<void()> path;
+    };
+    Easy game(3);
+    game.getSudoku();
+    unsigned char solution[81];
+    volatile bool sink = false;
+
+    vector<Check> checks = {
+        {"isValidMove", 0, [&] { for (int i = 0; i < 1000; ++i) sink = game.isValidMove(i % 9, i / 9 % 9, i % 9 + 1); }},
+        {"conflictsOf", 0, [&] { for (int i = 0; i < 1000; ++i) sink = game.conflictsOf(i % 9, i / 9 % 9, i % 9 + 1).any(); }},
+        {"makeMove + undoMove", 0, [&] { for (int i = 0; i < 1000; ++i) if (game.makeMove(i % 9 + 1, i / 9 % 9 + 1, i % 9 + 1)) game.undoMove(); }},
+        {"isSolved", 0, [&] { for (int i = 0; i < 1000; ++i) sink = game.isSolved(); }},
+        {"processMove", 0, [&] { for (int i = 0; i < 1000; ++i) processMove(&game, i % 9 + 1, i / 9 % 9 + 1, i % 9 + 1); processMove(&game, -1, -1, -1); }},
+        {"solveBoard", 0, [&] { for (int i = 0; i < 100; ++i) sink = solveBoard(game.getCells(), solution) == 1; }},
+        {"portfolio solve", 0, [&] { for (int i = 0; i < 100; ++i) sink = solverPortfolio().solve(game, solution) == 1; }},
+        {"step solver", 0, [&] { StepSolver solver(game); LogicalStep step; while (solver.next(step)) sink = step.places(); }},
+        {"moves with auto marks", 0, [&] {
+            game.setPencilMode(PENCIL_AUTO);
+            for (int i = 0; i < 1000; ++i) if (game.makeMove(i % 9 + 1, i / 9 % 9 + 1, i % 9 + 1)) game.undoMove();
+            game.setPencilMode(PENCIL_OFF); }},
+        {"full game replay", 0, [&] { for (int d = 0; d < 3; ++d) sink = replayToSolution(d, 4); }},
+    };
+
+    bool failed = false;
+    for (int d = 0; d < 3; ++d)
+        if (!replayToSolution(d, 4))
+        {
+            printf("Replay of %s level 4 did not end solved\n", DIFFICULTY_NAMES[d]);
+            failed = true;
+        }
+    for (Check& check : checks)
+    {
+        long long allocations, bytes;
+        check.path();                                        // Warm up
+        game.getSudoku();
+        countAllocations(check.path, allocations, bytes);
+        game.getSudoku();
+        bool ok = allocations <= check.limit;
+        failed = failed || !ok;
+        printf("%-22s %6lld allocations %8lld bytes   %s\n", check.name, allocations, bytes, ok ? "ok" : "FAIL");
+    }
+
+    long long slabsBefore = gamePool.slabMallocs;
+    long long allocations, bytes;
+    vector<Sudoku*> games;
+    games.reserve(10000);
+    countAllocations([&] { for (int i = 0; i < 10000; ++i) games.push_back(createGame("easy", 1)); }, allocations, bytes);
+    for (Sudoku* g : games)
+        delete g;
+    long long slabBytes = (gamePool.slabMallocs - slabsBefore) * 64 * GAME_BLOCK_BYTES;
+    printf("\nMemory per hosted game: %d byte game block (object is %d bytes)", (int)GAME_BLOCK_BYTES, (int)sizeof(Easy));
+#ifdef __linux__
+    printf(" + %d byte server session", (int)sizeof(Session));
+#endif
+    printf("\n10000 games: %.1f pool bytes per game, %.1f other heap bytes per game\n",
+           (double)slabBytes / 10000, (double)bytes / 10000);
+    return failed ? 1 : 0;
+}
+
+// ---------------- PUZZLE FILE TOOLS ---------------------
+// --parse checks a puzzle file and counts its puzzles; --bench-parse measures parser throughput.
+int runParseFile(const string& path)
+{
+    long long puzzles = 0;
+    string error;
+    if (!forEachPuzzle(path, [&](const unsigned char*, long long, const Variant&) { ++puzzles; return true; }, error))
+    {
+        cout << path << ": " << error << "\n";
+        return 1;
+    }
+    cout << path << ": " << puzzles << " puzzles\n";
+    return 0;
+}
+
+int runIngest(const string& path, bool solve)
+{
+#ifdef __linux__
+    long long puzzles = 0, solved = 0, bytes = 0;
+    unsigned char solution[81];
+    bool usedUring = false;
+    string error;
+    auto startTime = steady_clock::now();
+    bool ok = ingestPuzzleFile(path, [&](const unsigned char* cells, long long, const Variant& variant)
+    {
+        ++puzzles;
+        if (solve)
+            solved += solveBoard(cells, solution, 1, variant) == 1;
+        return true;
+    }, error, &usedUring);
+    double secs = duration_cast<duration<double>>(steady_clock::now() - startTime).count();
+    if (!ok)
+    {
+        cout << path << ": " << error << "\n";
+        return 1;
+    }
+    struct stat info;
+    if (stat(path.c_str(), &info) == 0)
+        bytes = info.st_size;
+    cout << path << ": " << puzzles << " puzzles";
+    if (solve)
+        cout << ", " << solved << " solved";
+    cout << " in " << secs * 1000 << " ms (" << bytes / secs / 1e6 << " MB/s, "
+         << (usedUring ? "io_uring" : "pread") << ")\n";
+    return 0;
+#else
+    return runParseFile(path);
+#endif
+}
+
+int runParseBenchmark(int megabytes)
+{
+    string lines;                                            // The 30 shipped puzzles as 81 character lines
+    for (int d = 0; d < 3; ++d)
+        for (int lvl = 1; lvl <= 10; ++lvl)
+        {
+            Sudoku* game = createGame(DIFFICULTY_NAMES[d], lvl);
+            game->getSudoku();
+            string cells = boardToString(game->getCells());
+            replace(cells.begin(), cells.end(), '0', '.');
+            lines += cells + "\n";
+            delete game;
+        }
+    string data;
+    data.reserve((size_t)megabytes << 20);
+    while (data.size() + lines.size() <= ((size_t)megabytes << 20))
+        data += lines;
+
+    PuzzleParser parser(FORMAT_LINES);
+    long long puzzles = 0, clues = 0;
+    auto startTime = steady_clock::now();
+    parser.parse(data.data(), data.size(), true, [&](const unsigned char* cells, long long, const Variant&)
+    {
+        ++puzzles;
+        clues += cells[0] != 0;                              // Touch the output so the work is not optimized away
+        return true;
+    });
+    double secs = duration_cast<duration<double>>(steady_clock::now() - startTime).count();
+    cout << puzzles << " puzzles (" << data.size() / 1e6 << " MB) parsed in " << secs * 1000 << " ms = "
+         << data.size() / secs / 1e9 << " GB/s, " << (long long)(puzzles / secs) << " puzzles/sec"
+         << (parser.failed() ? ", " + parser.getError() : string()) << "\n";
+    return clues < 0;
+}
+
+// --batch solves every puzzle of a file on all cores and writes one record per puzzle.
+int runBatchSolve(const string& path, OutputFormat format, const string& outPath, int threads,
+                  uint64_t limitNanos = 0)                   // Time allowed per puzzle, 0 - no limit
+{
+    FILE* file = (outPath.empty() || outPath == "-") ? stdout : fopen(outPath.c_str(), "wb");
+    if (file == nullptr)
+    {
+        cerr << "Cannot write " << outPath << "\n";
+        return 1;
+    }
+    BatchOutput output(file, format);
+    const size_t BATCH_PUZZLES = 4096;                       // Puzzles handed to a worker at a time
+
+    struct Batch
+    {
+        vector<unsigned char> cells;
+        vector<long long> lines;
+        Variant variant;                                     // Copied, the parser's copy dies before the workers finish
+        const Variant* source = &classicVariant();
+    };
+    mutex queueLock;
+    condition_variable queueChanged;
+    deque<Batch> queue;                                      // First in, first out keeps records near input order
+    bool done = false;
+    atomic<long long> puzzles(0), formatNanos(0), workerNanos(0), stopped(0);
+
+    auto worker = [&]()
+    {
+        BatchBuffer buffer(output);
+        unsigned char solution[81];
+        while (true)
+        {
+            Batch batch;
+            {
+                unique_lock<mutex> guard(queueLock);
+                queueChanged.wait(guard, [&] { return !queue.empty() || done; });
+                if (queue.empty())
+                    break;
+                batch = move(queue.front());
+                queue.pop_front();
+            }
+            queueChanged.notify_all();
+            uint64_t start = nowNanos(), formatting = 0;
+            for (size_t i = 0; i < batch.lines.size(); ++i)
+            {
+                const unsigned char* puzzle = &batch.cells[i * 81];
+                uint64_t solveStart = nowNanos();
+                Deadline deadline = {limitNanos == 0 ? 0 : solveStart + limitNanos, nullptr};
+                Bounded<BatchStats> stats(deadline);         // A pathological puzzle costs its worker limitNanos at most
+                int found = solveBoardTraced(puzzle, solution, 2, stats, batch.variant);
+                uint64_t solveEnd = nowNanos();
+                bool finished = stats.status == SOLVE_COMPLETE;
+                stopped += !finished;
+                buffer.add({batch.lines[i], puzzle, found > 0 ? solution : nullptr, found,
+                            finished ? ratePuzzle(found, stats) : SOLVE_STATUS_NAMES[stats.status], solveEnd - solveStart, stats.nodes});
+                formatting += nowNanos() - solveEnd;
+            }
+            puzzles += batch.lines.size();
+            formatNanos += formatting;
+            workerNanos += nowNanos() - start;
+        }
+    };
+
+    auto startTime = steady_clock::now();
+    vector<thread> workers;
+    for (int t = 0; t < threads; ++t)
+        workers.emplace_back(worker);
+
+    Batch next;
+    next.variant = classicVariant();
+    auto submit = [&]()
+    {
+        unique_lock<mutex> guard(queueLock);
+        queueChanged.wait(guard, [&] { return queue.size() < (size_t)threads * 2; });   // Bound memory on huge files
+        queue.push_back(move(next));
+        next = Batch();
+        next.variant = queue.back().variant;                 // The parser's copy may already be gone
+        next.source = queue.back().source;
+        guard.unlock();
+        queueChanged.notify_all();
+    };
+    string error;
+    bool ok = forEachPuzzle(path, [&](const unsigned char* cells, long long line, const Variant& variant)
+    {
+        if (&variant != next.source)                         // A #variant line: puzzles after it go in a new batch
+        {
+            if (!next.lines.empty())
+                submit();
+            next.variant = variant;
+            next.source = &variant;
+        }
+        next.cells.insert(next.cells.end(), cells, cells + 81);
+        next.lines.push_back(line);
+        if (next.lines.size() == BATCH_PUZZLES)
+            submit();
+        return true;
+    }, error);
+    if (!next.lines.empty())
+        submit();
+    {
+        lock_guard<mutex> guard(queueLock);
+        done = true;
+    }
+    queueChanged.notify_all();
+    for (thread& t : workers)
+        t.join();
+    double secs = duration_cast<duration<double>>(steady_clock::now() - startTime).count();
+    bool written = output.good();
+    if (file != stdout)
+        written = fclose(file) == 0 && written;
+
+    if (!ok)
+        cerr << path << ": " << error << "\n";
+    if (!written)
+        cerr << "Cannot write " << outPath << "\n";
+    cerr << puzzles << " puzzles in " << secs * 1000 << " ms on " << threads << " threads = "
+         << (long long)(puzzles / secs) << " puzzles/sec, formatting "
+         << 100.0 * formatNanos / max(workerNanos.load(), 1LL) << "% of worker time";
+    if (limitNanos > 0)
+        cerr << ", " << stopped << " hit the " << limitNanos / 1e6 << " ms limit";
+    cerr << "\n";
+    return (ok && written) ? 0 : 1;
+}
+
+// --samurai solves every puzzle of a Samurai file and times the corner grids solved one after
+// the other against solved on the GridWorkers.
+int runSamuraiSolve(const string& path, int rounds)
 {
-protected:
-    string difficulty;
-    int level;
-    vector<vector<int>> original;
-    vector<vector<int>> current;
-    vector<vector<int>> previous;
-    int mistakeCount;
-public:
-    Sudoku() {};                                                                                                  // Default Constructor 
-    Sudoku(string diff, int lvl, int mistake = 0) : level(lvl), difficulty(diff), mistakeCount(mistake) {};       // Constructor with initialisation list 
+    vector<unsigned char> puzzles;
+    string error;
+    if (!forEachSamurai(path, [&](const unsigned char* board, long long)
+        {
+            puzzles.insert(puzzles.end(), board, board + SamuraiLayout::CELLS);
+            return true;
+        }, error))
+    {
+        cout << path << ": " << error << "\n";
+        return 1;
+    }
+    size_t count = puzzles.size() / SamuraiLayout::CELLS;
+    rounds = max(rounds, 1);
 
-    virtual vector<vector<int>> getSudoku() = 0;                 // Pure Virtual Method
+    int unique = 0, agree = 0;
+    unsigned char serial[SamuraiLayout::CELLS], parallel[SamuraiLayout::CELLS];
+    for (size_t i = 0; i < count; ++i)
+    {
+        const unsigned char* puzzle = &puzzles[i * SamuraiLayout::CELLS];
+        int found = solveSamurai(puzzle, serial, 2);
+        unique += found == 1;
+        agree += found == solveSamurai(puzzle, parallel, 2, true) && (found == 0 || memcmp(serial, parallel, sizeof(serial)) == 0);
+    }
 
-    void initializeSudoku(const vector<vector<int>>& puzzle)
+    double millis[2];
+    for (int mode = 0; mode < 2; ++mode)
     {
-        original = puzzle;                                    //default copy constructor
-        current = puzzle;
-        previous = puzzle;
-        mistakeCount = 0;
+        uint64_t start = nowNanos();
+        for (int r = 0; r < rounds; ++r)
+            for (size_t i = 0; i < count; ++i)
+                solveSamurai(&puzzles[i * SamuraiLayout::CELLS], serial, 2, mode == 1);
+        millis[mode] = (nowNanos() - start) / 1e6 / rounds;
     }
-    bool undoMove()                                          // true - prevoius to current
-    {                                                        // flase - no moves to undo
-        if (current == previous)
-            return false;
-        current = previous;
-        return true;
+    cout << path << ": " << count << " puzzles, " << unique << " with a unique solution, "
+         << agree << " solved alike serial and parallel\n";
+    cout << "serial:   " << millis[0] << " ms per pass (" << millis[0] * 1000 / max(count, (size_t)1) << " us per puzzle)\n";
+    cout << "parallel: " << millis[1] << " ms per pass (" << millis[1] * 1000 / max(count, (size_t)1) << " us per puzzle), "
+         << GridWorkers::THREADS << " workers + caller, speedup " << millis[0] / millis[1] << "x\n";
+    return agree == (int)count ? 0 : 1;
+}
+
+// --portfolio solves a puzzle file with each engine alone, with the learned single-core pick,
+// and as a race, and checks that they all agree.
+int runPortfolioSolve(const string& path, int rounds)
+{
+    vector<unsigned char> puzzles;
+    string error;
+    if (!forEachPuzzle(path, [&](const unsigned char* cells, long long, const Variant&)
+        {
+            puzzles.insert(puzzles.end(), cells, cells + 81);
+            return true;
+        }, error))
+    {
+        cout << path << ": " << error << "\n";
+        return 1;
     }
+    size_t count = puzzles.size() / 81;
+    rounds = max(rounds, 1);
+    vector<unsigned char> expected(puzzles.size());
+    vector<int> expectedCount(count);
+    for (size_t i = 0; i < count; ++i)
+        expectedCount[i] = solveBoard(&puzzles[i * 81], &expected[i * 81], 2);
 
-    bool isOriginalCell(int row, int col) const              // true - change in ogiginal
-    {                                                        // false - no change in original
-        return original[row][col] != 0;
+    SolverPortfolio& portfolio = solverPortfolio();
+    const char* modes[] = {"mrv", "dlx", "propagate", "learned", "race"};
+    int wrong = 0;
+    for (int mode = 0; mode < 5; ++mode)
+    {
+        unsigned char solution[81];
+        SolveStatus status;
+        int used[ENGINES] = {};
+        uint64_t start = nowNanos();
+        for (int r = 0; r < rounds; ++r)
+            for (size_t i = 0; i < count; ++i)
+            {
+                const unsigned char* puzzle = &puzzles[i * 81];
+                int engine = mode, found;
+                if (mode < ENGINES)
+                    found = solveWithEngine(mode, puzzle, solution, 2, Deadline::none(), status);
+                else
+                    found = portfolio.solve(puzzle, classicVariant(), solution, 2, mode == 4, &engine);
+                ++used[engine];
+                // With several solutions each engine may report a different one first
+                wrong += found != expectedCount[i] || (found == 1 && memcmp(solution, &expected[i * 81], 81) != 0);
+            }
+        double micros = (nowNanos() - start) / 1e3 / rounds / max(count, (size_t)1);
+        cout << modes[mode] << ": " << micros << " us per puzzle";
+        if (mode >= ENGINES)
+            cout << " (mrv " << used[ENGINE_MRV] << ", dlx " << used[ENGINE_DLX] << ", propagate " << used[ENGINE_PROPAGATE] << ")";
+        cout << "\n";
     }
+    cout << "Learned per bucket:\n";
+    portfolio.print(cout);
+    cout << count << " puzzles, " << wrong << " answers differ from the reference solver\n";
+    return wrong == 0 ? 0 : 1;
+}
 
-    bool isValidMove(int row, int col, int num) const        // true - all check pass
-    {                                                        // false - any check fails
-        if (original[row][col] != 0)                         // Check if cell is editable (not part of original puzzle)
-            return false;
+// --bench-cancel measures what deadline checks cost on normal solves, and how quickly a
+// search that cannot finish gives up once its deadline passes or its token is cancelled.
+int runCancelBenchmark(const string& path, int rounds)
+{
+    vector<unsigned char> puzzles;
+    string error;
+    if (!forEachPuzzle(path, [&](const unsigned char* cells, long long, const Variant&)
+        {
+            puzzles.insert(puzzles.end(), cells, cells + 81);
+            return true;
+        }, error))
+    {
+        cout << path << ": " << error << "\n";
+        return 1;
+    }
+    size_t count = puzzles.size() / 81;
+    rounds = max(rounds, 1);
 
-        for (int j = 0; j < 9; j++)                          // Check row for duplicates
-            if (current[row][j] == num) return false;
+    CancelToken never;
+    Deadline far = Deadline::after(3600000000000ULL, &never); // Checked as usual, never reached
+    unsigned char solution[81];
+    uint64_t best[2] = {~0ULL, ~0ULL};
+    long long checksum[2] = {0, 0};
+    for (int r = 0; r < rounds; ++r)
+        for (int bounded = 0; bounded < 2; ++bounded)        // Interleaved, so both see the same machine state
+        {
+            long long sum = 0;
+            uint64_t start = nowNanos();
+            for (size_t i = 0; i < count; ++i)
+            {
+                SolveStatus status;
+                sum += bounded ? solveBoard(&puzzles[i * 81], solution, 2, far, status) : solveBoard(&puzzles[i * 81], solution, 2);
+            }
+            best[bounded] = min(best[bounded], nowNanos() - start);
+            checksum[bounded] = sum;
+        }
+    double overhead = 100.0 * ((double)best[1] - (double)best[0]) / (double)best[0];
+    cout << count << " puzzles, best of " << rounds << ": unbounded " << best[0] / 1e6 << " ms, with deadline and token "
+         << best[1] / 1e6 << " ms, overhead " << overhead << "% (checked every " << DEADLINE_CHECK_NODES << " nodes)\n";
 
-        for (int i = 0; i < 9; i++)                          // Check column for duplicates
-            if (current[i][col] == num) return false;
+    unsigned char empty[81] = {};                            // 6.7e21 solutions: counting them never ends
+    const uint64_t LIMIT = 20000000;
+    for (int engine = 0; engine < ENGINES; ++engine)
+    {
+        SolveStatus status;
+        Deadline deadline = Deadline::after(LIMIT);
+        int found = solveWithEngine(engine, empty, nullptr, INT32_MAX, deadline, status);
+        uint64_t late = nowNanos() - deadline.atNanos;
+        cout << ENGINE_NAMES[engine] << " counting the empty grid with a 20 ms deadline: " << SOLVE_STATUS_NAMES[status]
+             << " after " << found << " solutions, returned " << late / 1000.0 << " us past the deadline\n";
+    }
 
-        int boxRow = row - row % 3;                          // Check 3x3 box for duplicates
-        int boxCol = col - col % 3;
-        for (int i = boxRow; i < boxRow + 3; i++)            
-            for (int j = boxCol; j < boxCol + 3; j++)
-                if (current[i][j] == num) return false;
+    CancelToken token;
+    SolveStatus status;
+    uint64_t cancelledAt = 0;
+    thread canceller([&] { this_thread::sleep_for(milliseconds(20)); cancelledAt = nowNanos(); token.cancel(); });
+    int found = solveBoard(empty, nullptr, INT32_MAX, Deadline{0, &token}, status);
+    uint64_t returnedAt = nowNanos();
+    canceller.join();
+    cout << "mrv cancelled from another thread: " << SOLVE_STATUS_NAMES[status] << " after " << found
+         << " solutions, returned " << (returnedAt - cancelledAt) / 1000.0 << " us after cancel()\n";
 
-        return true;
-    }
+    unsigned char puzzle[81];
+    Deadline tight = Deadline::after(200000);
+    int reached = generatePuzzle(7, HARD, puzzle, tight, &status);
+    int clues = 0;
+    for (unsigned char c : puzzle)
+        clues += c != 0;
+    cout << "generatePuzzle with a 0.2 ms deadline: " << SOLVE_STATUS_NAMES[status] << ", reached "
+         << DIFFICULTY_NAMES[reached] << " with " << clues << " clues, still unique: " << (solveBoard(puzzle, nullptr, 2) == 1 ? "yes" : "no") << "\n";
+    return (checksum[0] == checksum[1] && overhead < 1.0) ? 0 : 1;
+}
 
-    bool makeMove(int row, int col, int num)
+// --explain solves every puzzle of a file with the step solver alone, printing the steps of the
+// first few. Timings compare one hint, on a fresh and on a half-played board, with a full solve.
+int runExplain(const string& path, int show)
+{
+    long long puzzles = 0, solved = 0, steps[TECHNIQUES] = {};
+    uint64_t firstHintNanos = 0, laterHintNanos = 0, fullNanos = 0;
+    string error;
+    bool ok = forEachPuzzle(path, [&](const unsigned char* cells, long long line, const Variant& rules)
     {
-        if (isValidMove(row - 1, col - 1, num))             // true - stores current in prevoius and edits current
+        Generated game(EASY, GENERATED_LEVELS);              // Any game can host the puzzle, it is never regenerated
+        game.start(cells, rules);
+        LogicalStep step;
+        uint64_t start = nowNanos();
+        StepSolver first(game);
+        first.next(step);
+        firstHintNanos += nowNanos() - start;
+
+        start = nowNanos();
+        StepSolver solver(game);
+        bool printing = puzzles < show;
+        if (printing)
+            cout << path << ":" << line << "\n";
+        for (const LogicalStep& s : solver)
         {
-            previous = current;
-            current[row - 1][col - 1] = num;
-            return true;
+            ++steps[s.technique];
+            if (printing)
+                cout << "  " << s.describe(rules) << "\n";
         }
-        return false;
-    }
+        fullNanos += nowNanos() - start;
+        solved += solver.emptyCells() == 0;
+        if (printing && solver.emptyCells() > 0)
+            cout << "  stuck with " << solver.emptyCells() << " cells left\n";
 
-    bool isSolved() const
+        unsigned char solution[81];                          // Half the game played, then a hint: the unit masks
+        if (solveBoard(cells, solution, 1, rules) == 1)      // are current, nothing is rebuilt
+        {
+            for (int p = 0, played = 0; p < 81 && played < 30; ++p)
+                if (cells[p] == 0)
+                    played += game.makeMove(p / 9 + 1, p % 9 + 1, solution[p]);
+            start = nowNanos();
+            StepSolver later(game);
+            later.next(step);
+            laterHintNanos += nowNanos() - start;
+        }
+        ++puzzles;
+        return true;
+    }, error);
+    if (!ok)
     {
-        for (int i = 0; i < 9; i++)
-            for (int j = 0; j < 9; j++)
-                if (current[i][j] == 0)
-                    return false;
+        cout << path << ": " << error << "\n";
+        return 1;
+    }
+    if (puzzles == 0)
+        return 0;
+    cout << puzzles << " puzzles, " << solved << " solved by these techniques alone\nSteps:";
+    for (int t = 0; t < TECHNIQUES; ++t)
+        cout << (t % 5 == 0 ? "\n  " : "  ") << TECHNIQUE_NAMES[t] << " " << steps[t];
+    cout << "\nFirst hint " << firstHintNanos / 1000.0 / puzzles << " us, hint after 30 moves "
+         << laterHintNanos / 1000.0 / puzzles << " us, every step to the end " << fullNanos / 1000.0 / puzzles << " us per puzzle\n";
+    return 0;
+}
 
-        for (int i = 0; i < 9; i++)
+// --generate times the grid generator on every thread, then generates the same grids again to
+// check that each is valid and the run is reproducible, writing them out if asked.
+int runGenerate(long long count, uint64_t seed, int threads, const string& outPath)
+{
+    seedGrids();                                             // Build the library outside the timing
+    long long perThread = (count + threads - 1) / threads;
+    vector<uint64_t> checksums(threads, 0);
+    auto startTime = steady_clock::now();
+    vector<thread> workers;
+    for (int t = 0; t < threads; ++t)
+        workers.emplace_back([&, t]
         {
-            vector<bool> seen(10, false);
-            for (int j = 0; j < 9; j++)
+            GridGenerator generator(seed, t);
+            unsigned char grid[81];
+            uint64_t sum = 0;
+            for (long long i = 0; i < perThread; ++i)
             {
-                int num = current[i][j];
-                if (num == 0 || seen[num]) return false;
-                seen[num] = true;
+                generator.next(grid);
+                sum = sum * 31 + grid[i % 81];               // Use the output so the work is not optimized away
             }
-        }
+            checksums[t] = sum;
+        });
+    for (thread& w : workers)
+        w.join();
+    double secs = duration_cast<duration<double>>(steady_clock::now() - startTime).count();
 
-        for (int j = 0; j < 9; j++)
+    FILE* file = outPath.empty() ? nullptr : (outPath == "-") ? stdout : fopen(outPath.c_str(), "wb");
+    if (!outPath.empty() && file == nullptr)
+    {
+        cerr << "Cannot write " << outPath << "\n";
+        return 1;
+    }
+    long long invalid = 0, mismatched = 0;
+    for (int t = 0; t < threads; ++t)
+    {
+        GridGenerator generator(seed, t);
+        unsigned char grid[81];
+        char line[82];
+        uint64_t sum = 0;
+        for (long long i = 0; i < perThread; ++i)
         {
-            vector<bool> seen(10, false);
-            for (int i = 0; i < 9; i++)
+            generator.next(grid);
+            sum = sum * 31 + grid[i % 81];
+            invalid += !isCompleteGrid(grid);
+            if (file != nullptr)
             {
-                int num = current[i][j];
-                if (num == 0 || seen[num]) return false;
-                seen[num] = true;
+                for (int p = 0; p < 81; ++p)
+                    line[p] = char('0' + grid[p]);
+                line[81] = '\n';
+                fwrite(line, 1, sizeof(line), file);
             }
         }
+        mismatched += sum != checksums[t];
+    }
+    if (file != nullptr && file != stdout)
+        fclose(file);
+
+    long long total = perThread * threads;
+    cerr << total << " grids in " << secs * 1000 << " ms on " << threads << " threads = " << (long long)(total / secs)
+         << " grids/sec, seed " << seed << ", " << invalid << " invalid, "
+         << (mismatched == 0 ? "reproducible" : "NOT reproducible") << "\n";
+    return (invalid == 0 && mismatched == 0) ? 0 : 1;
+}
+
+// --bench-levels times deriving levels from their ids, and checks on a sample that a derived
+// level has the same clue count and a unique solution like its shipped puzzle, and that an
+// id always gives the same board.
+int runLevelBenchmark(long long count)
+{
+    Sudoku* shipped[3][10];
+    for (int d = 0; d < 3; ++d)
+        for (int lvl = 1; lvl <= 10; ++lvl)
+        {
+            shipped[d][lvl - 1] = createGame(DIFFICULTY_NAMES[d], lvl);
+            shipped[d][lvl - 1]->getSudoku();
+        }
+
+    Rng rng(1);
+    unsigned char board[81];
+    uint64_t sum = 0;
+    uint64_t start = nowNanos();
+    for (long long i = 0; i < count; ++i)
+    {
+        long long level = 1 + (long long)(rng.next() % (uint64_t)MAX_LEVEL);
+        levelTransform(level, classicVariant()).apply(shipped[i % 3][baseLevel(level) - 1]->getCells(), board);
+        sum += board[i % 81];                                // Use the output so the work is not optimized away
+    }
+    double nanos = (double)(nowNanos() - start) / max(count, 1LL);
+
+    int checked = 0, bad = 0;
+    unsigned char again[81];
+    for (int i = 0; i < 3000; ++i)
+    {
+        int d = i % 3;
+        long long level = 1 + (long long)(rng.next() % (uint64_t)MAX_LEVEL);
+        Sudoku* game = createGame(DIFFICULTY_NAMES[d], level);
+        game->getSudoku();
+        memcpy(board, game->getCells(), 81);
+        game->getSudoku();
+        memcpy(again, game->getCells(), 81);
+        const unsigned char* base = shipped[d][baseLevel(level) - 1]->getCells();
+        int clues = 0, baseClues = 0;
+        for (int p = 0; p < 81; ++p)
+        {
+            clues += board[p] != 0;
+            baseClues += base[p] != 0;
+        }
+        bad += memcmp(board, again, 81) != 0 || clues != baseClues || solveBoard(board, nullptr, 2) != solveBoard(base, nullptr, 2);
+        ++checked;
+        delete game;
+    }
+    for (auto& row : shipped)
+        for (Sudoku* game : row)
+            delete game;
+    cout << count << " levels derived, " << nanos << " ns per level (checksum " << sum % 1000 << "); "
+         << checked << " checked against their shipped puzzle, " << bad << " differ\n";
+    return bad == 0 ? 0 : 1;
+}
 
-        for (int boxRow = 0; boxRow < 9; boxRow += 3)
-            for (int boxCol = 0; boxCol < 9; boxCol += 3)
+// --bench-new-game compares making a puzzle on the request path with taking one from the pool.
+int runNewGameBenchmark(int games, int producers, int gapMicros)
+{
+    for (int d = 0; d < 3; ++d)                              // On the request path: generate until one rates right
+    {
+        unsigned char puzzle[81];
+        uint64_t worst = 0, total = 0;
+        for (uint64_t seed = 1, made = 0; made < 20; ++seed)
+        {
+            uint64_t start = nowNanos();
+            bool rated = generatePuzzle(seed, d, puzzle) == d;
+            uint64_t nanos = nowNanos() - start;
+            total += nanos;
+            if (rated)
             {
-                vector<bool> seen(10, false);
-                for (int i = 0; i < 3; i++)
-                    for (int j = 0; j < 3; j++)
-                    {
-                        int num = current[boxRow + i][boxCol + j];
-                        if (num == 0 || seen[num]) return false;
-                        seen[num] = true;
-                    }
+                worst = max(worst, total);
+                ++made;
+                total = 0;
             }
-        return true;
+        }
+        cout << DIFFICULTY_NAMES[d] << " generated on demand: worst of 20 " << worst / 1e6 << " ms\n";
     }
 
-    // Getter Methods 
-    string getDifficulty() const { return difficulty; }
-    int getLevel() const { return level; }
-    int getMistakeCount() const { return mistakeCount; }
-    int increaseMistakeCount() { return ++mistakeCount; }
-    const vector<vector<int>>& getCurrentBoard() const { return current; }
-};
+    PuzzlePool& pool = puzzlePool();
+    uint64_t fillStart = nowNanos();
+    pool.start(producers, 42);
+    while (nowNanos() - fillStart < 60000000000ULL &&
+           (pool.depth(EASY) < POOL_HIGH_WATERMARK || pool.depth(MEDIUM) < POOL_HIGH_WATERMARK || pool.depth(HARD) < POOL_HIGH_WATERMARK))
+        this_thread::sleep_for(milliseconds(10));
+    cout << "Pools filled to " << pool.depth(EASY) << "/" << pool.depth(MEDIUM) << "/" << pool.depth(HARD) << " by "
+         << producers << " producers in " << (nowNanos() - fillStart) / 1e9 << " s\n";
 
-// ---------------- EASY, MEDIUM, HARD CLASSES --------------
-class Easy : public Sudoku
-{
-    vector<vector<vector<int>>> puzzles;          
-public:
-    Easy(int lvl) : Sudoku("easy", lvl)           // Base class costructor in initialization list
-    { 
-        loadPuzzles(); 
-    }      
-    void loadPuzzles()                            // Loads 10 puzzles from file
+    vector<uint64_t> latencies;
+    latencies.reserve(games);
+    int starved = 0, bad = 0;
+    for (int i = 0; i < games; ++i)
     {
-        ifstream file("easy.txt");
-        for (int p = 0; p < 10; ++p)
+        uint64_t start = nowNanos();
+        Sudoku* game = newPooledGame(i % 3);
+        latencies.push_back(nowNanos() - start);
+        if (!isGeneratedLevel(game->getLevel()))
+            ++starved;
+        else if (i < 60)                                     // A sample: unique, and the level id gives the same board
         {
-            vector<vector<int>> board(9, vector<int>(9));
-            for (int i = 0; i < 9; ++i)
-                for (int j = 0; j < 9; ++j)
-                    file >> board[i][j];
-            puzzles.push_back(board);
-            file.ignore(numeric_limits<streamsize>::max(), '\n');
+            Sudoku* again = createGame(game->getDifficulty(), game->getLevel());
+            again->getSudoku();
+            bad += solveBoard(game->getCells(), nullptr, 2) != 1 || memcmp(game->getCells(), again->getCells(), 81) != 0;
+            delete again;
         }
-        file.close();
+        delete game;
+        if (gapMicros > 0)
+            this_thread::sleep_for(microseconds(gapMicros));
     }
-    vector<vector<int>> getSudoku()                // Returns the puzzle of required level 
+    sort(latencies.begin(), latencies.end());
+    auto at = [&](double q) { return latencies.empty() ? 0 : latencies[min(latencies.size() - 1, (size_t)(q * latencies.size()))]; };
+    cout << games << " games started from the pool: p50 " << at(0.5) << " ns, p99 " << at(0.99) << " ns, max "
+         << (latencies.empty() ? 0 : latencies.back()) << " ns; " << starved << " starved (fell back to a derived level), "
+         << bad << " bad; depth now " << pool.depth(EASY) << "/" << pool.depth(MEDIUM) << "/" << pool.depth(HARD) << "\n";
+    return bad == 0 ? 0 : 1;
+}
+
+// ---------------- MINIMAL CLUE SEARCH -------------------
+// --min-clues hunts for puzzles with as few clues as possible (17 is the known minimum), a long
+// stress run for the generator and solver. Workers take random grids by index and strip clues
+// while the puzzle stays unique. Before each uniqueness search the candidate is checked against
+// the grid's unavoidable sets: groups of cells whose digits can be rearranged into another valid
+// grid, so one of them must stay a clue. A candidate that empties a set cannot be unique and is
+// skipped without a search. A minimal puzzle is then improved by exchanges, two clues out and one
+// other cell in, until none helps or the grid's budget runs out.
+// A checkpoint file is rewritten every few seconds. Started again with the same file, the job
+// continues from the first grid not finished, skips the grids above it that were, and keeps the
+// best puzzle and totals so far. Totals cover finished grids only, so a grid cut short by the
+// stop is counted once, when a later run finishes it.
+// Progress goes to stdout and, as Prometheus text, to the checkpoint path + ".prom".
+const int MAX_UNAVOIDABLE_SETS = 384;
+const long long EXCHANGE_BUDGET = 20000;                     // Candidates per grid spent on exchanges
+const int CHECKPOINT_SECONDS = 5;
+
+struct UnavoidableSets
+{
+    uint64_t cells[MAX_UNAVOIDABLE_SETS][2];                 // Bit p set - cell p is in the set
+    int count;
+};
+
+struct UnavoidableCollector                                  // searchBoard's completion step: keeps where each
+{                                                            // other solution differs from the grid
+    const unsigned char* grid;
+    vector<pair<uint64_t, uint64_t>>& found;
+
+    int operator()(const unsigned char* cells)
     {
-        vector<vector<int>> puzzle = puzzles[level - 1];
-        initializeSudoku(puzzle);
-        return puzzle;
+        uint64_t diff[2] = {0, 0};
+        for (int p = 0; p < 81; ++p)
+            if (cells[p] != grid[p])
+                diff[p >> 6] |= 1ULL << (p & 63);
+        if (diff[0] | diff[1])
+            found.push_back({diff[0], diff[1]});
+        return 1;
     }
 };
 
-class Medium : public Sudoku
+void findUnavoidableSets(const unsigned char* grid, UnavoidableSets& sets)   // Small ones, not all of them
 {
-    vector<vector<vector<int>>> puzzles;
-public:
-    Medium(int lvl) : Sudoku("medium", lvl) { loadPuzzles(); }
-    void loadPuzzles()
+    vector<pair<uint64_t, uint64_t>> found;
+    UnavoidableCollector collect{grid, found};
+    NoTrace none;
+    unsigned char puzzle[81];
+    for (int digits = 0; digits < 1 << 9; ++digits)          // Blank every pair and triple of digits, the
+    {                                                        // other solutions show which cells could swap
+        if (countBits(digits) < 2 || countBits(digits) > 3)
+            continue;
+        for (int p = 0; p < 81; ++p)
+            puzzle[p] = ((digits >> (grid[p] - 1)) & 1) ? 0 : grid[p];
+        searchBoard<NoTrace, false>(puzzle, nullptr, 256, none, classicVariant(), collect);
+    }
+
+    auto size = [](const pair<uint64_t, uint64_t>& s) { return __builtin_popcountll(s.first) + __builtin_popcountll(s.second); };
+    sort(found.begin(), found.end(), [&](const pair<uint64_t, uint64_t>& a, const pair<uint64_t, uint64_t>& b) { return size(a) < size(b); });
+    sets.count = 0;
+    for (const auto& s : found)                              // Smallest first; a superset of a kept set adds nothing
     {
-        ifstream file("medium.txt");
-        for (int p = 0; p < 10; ++p)
+        bool covered = false;
+        for (int i = 0; i < sets.count && !covered; ++i)
+            covered = (sets.cells[i][0] & ~s.first) == 0 && (sets.cells[i][1] & ~s.second) == 0;
+        if (!covered && sets.count < MAX_UNAVOIDABLE_SETS)
         {
-            vector<vector<int>> board(9, vector<int>(9));
-            for (int i = 0; i < 9; ++i)
-                for (int j = 0; j < 9; ++j)
-                    file >> board[i][j];
-            puzzles.push_back(board);
-            string dummy;
-            getline(file, dummy);
+            sets.cells[sets.count][0] = s.first;
+            sets.cells[sets.count][1] = s.second;
+            ++sets.count;
         }
-        file.close();
-    }
-    vector<vector<int>> getSudoku()
-    {
-        vector<vector<int>> puzzle = puzzles[level - 1];
-        initializeSudoku(puzzle);
-        return puzzle;
     }
+}
+
+struct ClueSearchTotals                                      // Shared by all workers, live for the rate
+{                                                            // (grids still in progress included)
+    atomic<long long> tested;                                // Candidates given to the uniqueness search
+    atomic<long long> pruned;                                // Candidates ruled out by an unavoidable set
+    ClueSearchTotals() : tested(0), pruned(0) {};
 };
 
-class Hard : public Sudoku
+class ClueSearch                                             // One grid's clues, always a unique puzzle
 {
-    vector<vector<vector<int>>> puzzles;
+    const unsigned char* grid;
+    const UnavoidableSets& sets;
+    ClueSearchTotals& totals;
+    const CancelToken& stop;
+    uint64_t clues[2];
+    long long tested, pruned;                                // ...the same, for this grid alone
+
+    bool has(int p) const { return (clues[p >> 6] >> (p & 63)) & 1; }
+    void flip(int p) { clues[p >> 6] ^= 1ULL << (p & 63); }
+
+    bool isUnique()                                          // The clues as they are now
+    {
+        for (int i = 0; i < sets.count; ++i)
+            if (((sets.cells[i][0] & clues[0]) | (sets.cells[i][1] & clues[1])) == 0)
+            {
+                totals.pruned.fetch_add(1, memory_order_relaxed);
+                ++pruned;
+                return false;
+            }
+        totals.tested.fetch_add(1, memory_order_relaxed);
+        ++tested;
+        unsigned char puzzle[81];
+        for (int p = 0; p < 81; ++p)
+            puzzle[p] = has(p) ? grid[p] : 0;
+        return solveBoard(puzzle, nullptr, 2) == 1;
+    }
 public:
-    Hard(int lvl) : Sudoku("hard", lvl) { loadPuzzles(); }
-    void loadPuzzles()
+    ClueSearch(const unsigned char* g, const UnavoidableSets& s, ClueSearchTotals& t, const CancelToken& halt)
+        : grid(g), sets(s), totals(t), stop(halt), clues{~0ULL, (1ULL << 17) - 1}, tested(0), pruned(0) {};
+
+    int count() const { return __builtin_popcountll(clues[0]) + __builtin_popcountll(clues[1]); }
+    long long getTested() const { return tested; }
+    long long getPruned() const { return pruned; }
+
+    void puzzle(unsigned char* out) const
+    {
+        for (int p = 0; p < 81; ++p)
+            out[p] = has(p) ? grid[p] : 0;
+    }
+
+    void minimize(const unsigned char* order)                // Drops every clue it can, in this order
     {
-        ifstream file("hard.txt");
-        for (int p = 0; p < 10; ++p)
+        for (int i = 0; i < 81 && !stop.isCancelled(); ++i)
         {
-            vector<vector<int>> board(9, vector<int>(9));
-            for (int i = 0; i < 9; ++i)
-                for (int j = 0; j < 9; ++j)
-                    file >> board[i][j];
-            puzzles.push_back(board);
-            string dummy;
-            getline(file, dummy);
+            int p = order[i];
+            if (!has(p))
+                continue;
+            flip(p);
+            if (!isUnique())
+                flip(p);
         }
-        file.close();
     }
-    vector<vector<int>> getSudoku()
+
+    bool exchange(const unsigned char* order, long long& budget)   // true - two clues out and one in kept the puzzle unique
     {
-        vector<vector<int>> puzzle = puzzles[level - 1];
-        initializeSudoku(puzzle);
-        return puzzle;
+        for (int i = 0; i < 81; ++i)
+            for (int j = i + 1; j < 81; ++j)
+            {
+                int a = order[i], b = order[j];
+                if (!has(a) || !has(b))
+                    continue;
+                flip(a);
+                flip(b);
+                for (int k = 0; k < 81; ++k)
+                {
+                    int x = order[k];
+                    if (has(x) || x == a || x == b)
+                        continue;
+                    if (--budget < 0 || stop.isCancelled())
+                    {
+                        flip(a);
+                        flip(b);
+                        return false;
+                    }
+                    flip(x);
+                    if (isUnique())
+                        return true;
+                    flip(x);
+                }
+                flip(a);
+                flip(b);
+            }
+        return false;
     }
 };
 
-// ---------------- DISPLAY FUNCTIONS ------------------------
-void displayBoard(const vector<vector<int>>& board, Sudoku* game, int timeLeft)
+struct ClueSearchJob
 {
-    int minutes = timeLeft / 60;
-    int seconds = timeLeft % 60;
+    uint64_t seed;
+    long long nextGrid;                                      // Grids below the lowest one in progress are done
+    vector<long long> finishedAhead;                         // ...and so are these, above it
+    long long gridsDone;
+    long long tested, pruned;                                // Candidates of the finished grids, earlier runs included
+    double secondsBefore;
+    int bestClues;                                           // 82 - nothing found yet
+    unsigned char best[81];
 
-    cout << "\nYour Sudoku Board:\n\n";
-    cout << "     1  2  3   4  5  6   7  8  9       STATS\n";
-    cout << "   +---------+---------+---------+     ---------------------------------------\n";
+    ClueSearchJob(uint64_t s) : seed(s), nextGrid(0), gridsDone(0), tested(0), pruned(0), secondsBefore(0), bestClues(82), best{} {};
 
-    for (int i = 0; i < 9; ++i)
+    long long takeGrid()                                     // Next grid no run has finished
     {
-        cout << i + 1 << "  |";
-        for (int j = 0; j < 9; ++j)
-        {
-            if (board[i][j] == 0)
-                cout << " . ";
-            else
-                cout << " " << board[i][j] << " ";
-            if ((j + 1) % 3 == 0 && j != 8)
-                cout << "|";
-        }
-        if ((i + 1) % 3 == 0 && i != 8)
+        while (find(finishedAhead.begin(), finishedAhead.end(), nextGrid) != finishedAhead.end())
+            ++nextGrid;
+        return nextGrid++;
+    }
+
+    bool load(const string& path)                            // false - no checkpoint yet
+    {
+        ifstream file(path);
+        string key;
+        bool any = false;
+        while (file >> key)
         {
-            if (i == 2)
-            {
-                cout << "|     \n";
-                cout << "   +---------+---------+---------+";
-                cout << "     Mistakes : " << game->getMistakeCount() << "/5";
-                printf("     Time Left : %02d:%02d\n", minutes, seconds);
-            }
-            else if (i == 5)
+            if (key[0] == '#')
+                file.ignore(numeric_limits<streamsize>::max(), '\n');
+            else if (key == "seed") file >> seed;
+            else if (key == "next") file >> nextGrid;
+            else if (key == "finished")
             {
-                cout << "|     \n";
-                cout << "   +---------+---------+---------+     ---------------------------------------\n";
+                size_t count = 0;
+                file >> count;
+                finishedAhead.resize(count);
+                for (long long& index : finishedAhead)
+                    file >> index;
             }
-            else
+            else if (key == "grids") file >> gridsDone;
+            else if (key == "tested") file >> tested;
+            else if (key == "pruned") file >> pruned;
+            else if (key == "seconds") file >> secondsBefore;
+            else if (key == "best")
             {
-                cout << "|     \n";
-                cout << "   +---------+---------+---------+     \n";
+                string cells;
+                file >> bestClues >> cells;
+                for (int p = 0; p < 81 && cells.size() == 81; ++p)
+                    best[p] = (unsigned char)(cells[p] - '0');
             }
+            any = true;
         }
-        else
+        return any;
+    }
+
+    bool save(const string& path, long long next, double seconds)   // next - lowest grid in progress
+    {
+        finishedAhead.erase(remove_if(finishedAhead.begin(), finishedAhead.end(), [&](long long i) { return i < next; }),
+                            finishedAhead.end());
+        string tmp = path + ".tmp";                          // Written aside, then renamed: a crash leaves the old one
         {
-            cout << "|";
-            if (i == 0) cout << "     Difficulty : " << game->getDifficulty() << "     Level : " << game->getLevel() << "\n";
-            else if (i == 1) cout << "     ---------------------------------------\n";
-            else if (i == 3) cout << "     Undo : -1 -1 -1\n";
-            else if (i == 4) cout << "     Exit : 0 0 0\n";
-            else cout << "\n";
+            ofstream file(tmp);
+            file << "# --min-clues checkpoint\nseed " << seed << "\nnext " << next << "\nfinished " << finishedAhead.size();
+            for (long long index : finishedAhead)
+                file << " " << index;
+            file << "\ngrids " << gridsDone << "\ntested " << tested << "\npruned " << pruned << "\nseconds " << seconds << "\n";
+            if (bestClues <= 81)
+                file << "best " << bestClues << " " << boardToString(best) << "\n";
+            if (!file)
+                return false;
         }
+        return rename(tmp.c_str(), path.c_str()) == 0;
     }
-    cout << "   +---------+---------+---------+\n";
-}
-
-void displayRules()
-{
-    cout << "\n=========== SUDOKU RULES ===========\n";
-    cout << "1. Fill each row with numbers 1-9 without repetition\n";
-    cout << "2. Fill each column with numbers 1-9 without repetition\n";
-    cout << "3. Fill each 3x3 box with numbers 1-9 without repetition\n";
-    cout << "4. You cannot change the given numbers (clues)\n";
-    cout << "5. Limited time based on difficulty:\n";
-    cout << "   - Easy: 15 mins | Medium: 13 mins | Hard: 11 mins\n";
-    cout << "6. 5 mistakes allowed maximum\n\n";
-}
+};
 
-// ---------------- GAME LOGIC --------------------------
-bool playGame(Sudoku* game)                                  // Passing pointer of type Sudoku
+int runMinimalClueSearch(double seconds, int threads, const string& checkpointPath, uint64_t seed)   // seconds 0 - until killed
 {
-    vector<vector<int>> board = game->getSudoku();
-    int totalMinutes = (game->getDifficulty() == "easy") ? 15 : (game->getDifficulty() == "medium") ? 13 : 11;       // Use of ternary operator to set time limit
+    ClueSearchJob job(seed);
+    if (job.load(checkpointPath))
+        cout << "Resuming " << checkpointPath << ": seed " << job.seed << ", grid " << job.nextGrid << ", best "
+             << (job.bestClues <= 81 ? to_string(job.bestClues) : string("none")) << "\n";
+    seedGrids();
 
-    auto startTime = steady_clock::now();                   // now() returns time_point form monotic clock of chrono::steady_clock
+    ClueSearchTotals totals;
+    CancelToken stop;
+    mutex jobLock;                                           // Handing out grids, recording results, checkpoints
+    vector<long long> inProgress(threads, numeric_limits<long long>::max());
+    vector<thread> workers;
+    for (int t = 0; t < threads; ++t)
+        workers.emplace_back([&, t]
+        {
+            UnavoidableSets sets;
+            unsigned char grid[81], order[81], puzzle[81];
+            while (!stop.isCancelled())
+            {
+                long long index;
+                {
+                    lock_guard<mutex> guard(jobLock);
+                    index = inProgress[t] = job.takeGrid();
+                }
+                GridGenerator generator(job.seed + (uint64_t)index);   // Grid index alone decides the work, so a resume repeats it
+                generator.next(grid);
+                for (int i = 0; i < 81; ++i)
+                    order[i] = (unsigned char)i;
+                for (int i = 80; i > 0; --i)
+                    swap(order[i], order[generator.random().below(i + 1)]);
+                findUnavoidableSets(grid, sets);
 
-    cout << "\nGAME STARTS!\nYou have limited time and 5 mistakes allowed.\n";
-    displayBoard(board, game, totalMinutes * 60);
+                ClueSearch search(grid, sets, totals, stop);
+                search.minimize(order);
+                long long budget = EXCHANGE_BUDGET;
+                while (search.count() > 17 && search.exchange(order, budget))
+                    search.minimize(order);
+                if (stop.isCancelled())
+                    break;                                   // Unfinished, stays in progress for the checkpoint
 
-    bool gameOver = false;
+                lock_guard<mutex> guard(jobLock);
+                inProgress[t] = numeric_limits<long long>::max();
+                job.finishedAhead.push_back(index);
+                ++job.gridsDone;
+                job.tested += search.getTested();
+                job.pruned += search.getPruned();
+                if (search.count() < job.bestClues)
+                {
+                    job.bestClues = search.count();
+                    search.puzzle(puzzle);
+                    memcpy(job.best, puzzle, 81);
+                    cout << "New best: " << job.bestClues << " clues " << boardToString(puzzle) << " (grid " << index << ")\n";
+                }
+            }
+        });
 
-    while (!gameOver)
+    auto started = steady_clock::now();
+    long long lastTested = 0;
+    double lastElapsed = 0;
+    bool failed = false;
+    for (bool last = false; !last; )
     {
-        auto now = steady_clock::now();
-        int timePassed = duration_cast<seconds>(now - startTime).count();
-        int timeLeft = totalMinutes * 60 - timePassed;
-
-        if (timeLeft <= 0)
+        for (int tick = 0; tick < CHECKPOINT_SECONDS * 10 && !last; ++tick)
         {
-            cout << "\nTime's up! Game Over.\n";
-            return true;
+            this_thread::sleep_for(milliseconds(100));
+            last = seconds > 0 && duration_cast<duration<double>>(steady_clock::now() - started).count() >= seconds;
         }
-
-        int row, col, num;
-        cout << "\nEnter row, column, number (or -1 -1 -1 for undo or 0 0 0 to quit): ";
-        cin >> row >> col >> num;
-
-        if (row == 0 && col == 0 && num == 0)
+        if (last)
         {
-            cout << "Exiting...\n";
-            return true;
+            stop.cancel();
+            for (thread& w : workers)
+                w.join();
         }
 
-        if (row == -1 && col == -1 && num == -1)
-        {
-            if (game->undoMove())
-                cout << "Move undone successfully.\n";
-            else
-                cout << "No moves to undo.\n";
-            displayBoard(game->getCurrentBoard(), game, timeLeft);
-            continue;
-        }
+        double elapsed = duration_cast<duration<double>>(steady_clock::now() - started).count();
+        long long tested = totals.tested.load();
+        double rate = (tested - lastTested) / max(elapsed - lastElapsed, 1e-3);   // Over the last interval
+        lastTested = tested;
+        lastElapsed = elapsed;
 
-        if (row < 1 || row > 9 || col < 1 || col > 9 || num < 1 || num > 9)
+        lock_guard<mutex> guard(jobLock);
+        long long done = job.nextGrid;
+        for (long long index : inProgress)
+            done = min(done, index);
+        if (!job.save(checkpointPath, done, job.secondsBefore + elapsed))
         {
-            cout << "Invalid input! Must be 1-9.\n";
-            continue;
+            cerr << "Cannot write checkpoint " << checkpointPath << "\n";
+            failed = true;
         }
 
-        if (game->isOriginalCell(row - 1, col - 1))
-        {
-            cout << "Cannot modify original clue!\n";
-            continue;
-        }
+        char text[512];
+        snprintf(text, sizeof(text),
+                 "# TYPE sudoku_minclue_candidates_tested_total counter\nsudoku_minclue_candidates_tested_total %lld\n"
+                 "# TYPE sudoku_minclue_candidates_pruned_total counter\nsudoku_minclue_candidates_pruned_total %lld\n"
+                 "# TYPE sudoku_minclue_candidates_per_second gauge\nsudoku_minclue_candidates_per_second %.1f\n"
+                 "# TYPE sudoku_minclue_grids_total counter\nsudoku_minclue_grids_total %lld\n"
+                 "# TYPE sudoku_minclue_best_clues gauge\nsudoku_minclue_best_clues %d\n",
+                 job.tested, job.pruned, rate, job.gridsDone, job.bestClues <= 81 ? job.bestClues : 0);
+        ofstream prom(checkpointPath + ".prom");
+        prom << text << exportMetrics();
+        cout << (long long)elapsed << " s: " << job.gridsDone << " grids, " << (long long)rate << " candidates/sec tested, "
+             << job.pruned << " pruned by unavoidable sets, best "
+             << (job.bestClues <= 81 ? to_string(job.bestClues) : string("-")) << " clues\n";
+    }
+    return failed ? 1 : 0;
+}
 
-        if (game->makeMove(row, col, num))
+// ---------------- MAIN FUNCTION --------------------------
+// Sudoku_Game                                        -> interactive game
+// Sudoku_Game --serve <tcp PORT | unix PATH> [--log FILE [commit ms]]   -> host many games (Linux)
+// Sudoku_Game --loadgen <tcp PORT | unix PATH> [connections] [seconds]
+// Sudoku_Game --solve-service NAME [workers]          -> solver daemon for local processes, boards over shared memory (Linux)
+// Sudoku_Game --bench-service NAME FILE [threads]     -> in-process solver vs the daemon, throughput and round trip
+// Sudoku_Game --bench-log FILE [games] [moves] [commit ms]
+// Sudoku_Game --bench-pool [games] [solves]
+// Sudoku_Game --bench-marks [pairs]                  -> makeMove + undoMove with and without auto pencil marks
+// Sudoku_Game --bench-branches [operations]           -> random moves, undos, forks and switches checked against a model
+// Sudoku_Game --trace-solve <easy|medium|hard> <1-10> [trace.json] [sample every N nodes]
+// Sudoku_Game --check-alloc                           -> fails if a hot path allocates
+// Sudoku_Game --parse FILE                            -> validate a .txt/.sdm/.sdk puzzle file
+// Sudoku_Game --bench-parse [megabytes]
+// Sudoku_Game --ingest FILE [--solve]                 -> stream a puzzle file of any size
+// Sudoku_Game --batch FILE [ndjson|csv] [OUT|-] [threads] [ms per puzzle]   -> solve and rate every puzzle
+// Sudoku_Game --samurai FILE [rounds]                 -> solve Samurai puzzles, corner grids serial vs parallel
+// Sudoku_Game --portfolio FILE [rounds]               -> each solver engine alone, learned pick, and a race
+// Sudoku_Game --bench-cancel FILE [rounds]            -> cost of deadline checks, and how fast a search gives up
+// Sudoku_Game --explain FILE [show]                   -> human-style steps for every puzzle, printed for the first few
+// Sudoku_Game --generate [count] [seed] [threads] [OUT|-]   -> random complete grids, reproducible from the seed
+// Sudoku_Game --bench-levels [count]                  -> time deriving levels beyond the shipped 10
+// Sudoku_Game --bench-new-game [games] [producers] [gap us]   -> new-game latency from the puzzle pool
+// Sudoku_Game --min-clues [seconds, 0 = no limit] [threads] [checkpoint file] [seed]   -> hunt for puzzles with few clues
+int main(int argc, char* argv[])
+{
+    string mode = (argc > 1) ? argv[1] : "";
+    if (mode == "--bench-branches")
+        return runBranchBenchmark((argc > 2) ? atoi(argv[2]) : 20000);
+    if (mode == "--bench-marks")
+        return runPencilBenchmark((argc > 2) ? atoi(argv[2]) : 1000000);
+    if (mode == "--bench-pool")
+        return runPoolBenchmark((argc > 2) ? atoi(argv[2]) : 1000000, (argc > 3) ? atoi(argv[3]) : 10000);
+    if (mode == "--check-alloc")
+        return runAllocationChecks();
+    if (mode == "--parse" && argc >= 3)
+        return runParseFile(argv[2]);
+    if (mode == "--ingest" && argc >= 3)
+        return runIngest(argv[2], argc > 3 && string(argv[3]) == "--solve");
+    if (mode == "--batch" && argc >= 3)
+    {
+        OutputFormat format = (argc > 3 && string(argv[3]) == "csv") ? OUTPUT_CSV : OUTPUT_NDJSON;
+        int threads = (argc > 5) ? atoi(argv[5]) : (int)max(1u, thread::hardware_concurrency());
+        return runBatchSolve(argv[2], format, (argc > 4) ? argv[4] : "-", max(threads, 1),
+                             (argc > 6) ? (uint64_t)(atof(argv[6]) * 1e6) : 0);
+    }
+    if (mode == "--portfolio" && argc >= 3)
+        return runPortfolioSolve(argv[2], (argc > 3) ? atoi(argv[3]) : 1);
+    if (mode == "--explain" && argc >= 3)
+        return runExplain(argv[2], (argc > 3) ? atoi(argv[3]) : 1);
+    if (mode == "--bench-cancel" && argc >= 3)
+        return runCancelBenchmark(argv[2], (argc > 3) ? atoi(argv[3]) : 5);
+    if (mode == "--samurai" && argc >= 3)
+        return runSamuraiSolve(argv[2], (argc > 3) ? atoi(argv[3]) : 10);
+    if (mode == "--generate")
+    {
+        int threads = (argc > 4) ? atoi(argv[4]) : (int)max(1u, thread::hardware_concurrency());
+        return runGenerate((argc > 2) ? atoll(argv[2]) : 10000000, (argc > 3) ? strtoull(argv[3], nullptr, 10) : 1,
+                           max(threads, 1), (argc > 5) ? argv[5] : "");
+    }
+    if (mode == "--bench-levels")
+        return runLevelBenchmark((argc > 2) ? atoll(argv[2]) : 10000000);
+    if (mode == "--bench-new-game")
+        return runNewGameBenchmark((argc > 2) ? atoi(argv[2]) : 3000, (argc > 3) ? max(1, atoi(argv[3])) : 1,
+                                   (argc > 4) ? atoi(argv[4]) : 1000);
+    if (mode == "--min-clues")
+    {
+        int threads = (argc > 3) ? atoi(argv[3]) : (int)max(1u, thread::hardware_concurrency());
+        return runMinimalClueSearch((argc > 2) ? atof(argv[2]) : 60, max(threads, 1), (argc > 4) ? argv[4] : "minclues.ckpt",
+                                    (argc > 5) ? strtoull(argv[5], nullptr, 10) : 1);
+    }
+    if (mode == "--bench-parse")
+        return runParseBenchmark((argc > 2) ? atoi(argv[2]) : 256);
+    if (mode == "--trace-solve" && argc >= 4)
+        return runTraceSolve(argv[2], atoi(argv[3]), (argc > 4) ? argv[4] : "", (argc > 5) ? atoi(argv[5]) : 64);
+    if (mode == "--serve" || mode == "--loadgen" || mode == "--bench-log" || mode == "--solve-service" || mode == "--bench-service")
+    {
+#ifdef __linux__
+        if (mode == "--solve-service" && argc >= 3)
+            return runSolveService(argv[2], (argc > 3) ? atoi(argv[3]) : (int)max(1u, thread::hardware_concurrency()));
+        if (mode == "--bench-service" && argc >= 4)
+            return runServiceBenchmark(argv[2], argv[3], (argc > 4) ? atoi(argv[4]) : 1);
+        if (mode == "--bench-log" && argc >= 3)
+            return runLogBenchmark(argv[2], (argc > 3) ? atoi(argv[3]) : 1000, (argc > 4) ? atoi(argv[4]) : 1000000,
+                                   (argc > 5) ? atoi(argv[5]) : 2);
+        if (mode == "--serve" && argc >= 4)
         {
-            cout << "Move accepted!\n";
-            displayBoard(game->getCurrentBoard(), game, timeLeft);
-
-            if (game->isSolved())
-            {
-                cout << "\nCongratulations! You solved the Sudoku!\nWell played! ";
-                cout << "Time taken: " << timePassed / 60 << " minutes\n";
-                gameOver = true;
-            }
+            bool logging = argc >= 6 && string(argv[4]) == "--log";
+            return runServer(argv[2], argv[3], logging ? argv[5] : "", (argc > 6) ? atoi(argv[6]) : 2);
         }
-        else
+        if (mode == "--loadgen" && argc >= 4)
         {
-            cout << "Invalid move! Mistakes: " << game->increaseMistakeCount() << "/5\n";
-            if (game->getMistakeCount() >= 5)
-            {
-                cout << "Too many mistakes! Game Over.\nBetter luck next time!\n";
-                return true;
-            }
+            int connections = (argc > 4) ? atoi(argv[4]) : 64;
+            int durationSecs = (argc > 5) ? atoi(argv[5]) : 5;
+            return runLoadGenerator(argv[2], argv[3], connections, durationSecs);
         }
+        cout << "Missing arguments, see the usage above main().\n";
+        return 1;
+#else
+        cout << "Server mode is only available on Linux.\n";
+        return 1;
+#endif
     }
-    return true;
-}
 
-// ---------------- MAIN FUNCTION --------------------------
-int main()
-{
+    puzzlePool().start(1, nowNanos());                       // Fills while the player reads the rules
     scrollSudoku(50, 10);
 
     cout << "\n========== WELCOME TO SUDOKU ==========\n";
@@ -380,32 +7656,58 @@ int main()
                                                                     
     while (choice == "yes" || choice == "y" || choice == "Y")
     {
-        cout << "\nChoose difficulty (easy/medium/hard): ";
+        int elapsedSecs = 0;
+        game = loadGameFromFile(SAVE_FILE, elapsedSecs);
+        if (game != nullptr)
+        {
+            cout << "\nResume saved " << game->getDifficulty() << " level " << game->getLevel() << " game? (yes/no): ";
+            string resume;
+            cin >> resume;
+            remove(SAVE_FILE);                                 // A saved game can be resumed only once
+            if (resume == "yes" || resume == "y" || resume == "Y")
+            {
+                playGame(game, true, elapsedSecs);
+                delete game;
+                cout << "\nWant to play again? (yes/no): ";
+                cin >> choice;
+                continue;
+            }
+            delete game;
+        }
+
+        cout << "\nChoose difficulty (easy/medium/hard/samurai): ";
         string diff;
         cin >> diff;
-        if(diff != "easy" && diff != "medium" && diff != "hard") 
+        if(diff != "easy" && diff != "medium" && diff != "hard" && diff != "samurai") 
         {
             cout << "Invalid difficulty level. Try again\n";
-            continue; 
+            continue;
         }
 
 
-        cout << "Choose level (1-10): ";
-        int lvl;
+        cout << "Choose level (1-10, or any higher number for a new board of the same difficulty";
+        cout << (diff == "samurai" ? "): " : ", 0 for a freshly generated puzzle): ");
+        long long lvl;
         cin >> lvl;
-        if(lvl < 1 || lvl > 10) 
+        bool generated = lvl == 0 && diff != "samurai";
+        if(!generated && (lvl < 1 || lvl > (diff == "samurai" ? SHIPPED_LEVELS : MAX_LEVEL)))
         {
-            cout << "Invalid level. Please select a level between 1 and 10.\n";
-            continue; 
+            cout << "Invalid level. Please select a level between 1 and " << (diff == "samurai" ? SHIPPED_LEVELS : MAX_LEVEL) << ".\n";
+            continue;
         }
 
-        if (diff == "easy")                       
-            game = new Easy(lvl);                        // Dynamic Binding of game : Easy
-        else if (diff == "medium")
-            game = new Medium(lvl);                      // Dynamic Binding of game : Medium
-        else if (diff == "hard")
-            game = new Hard(lvl);                        // Dynamic Binding of game : Hard
-        else
+        if (diff == "samurai")
+        {
+            Samurai* samurai = new Samurai(lvl);             // 21x21 board, too big for the GamePool
+            playGame(samurai);
+            delete samurai;
+            cout << "\nWant to play again? (yes/no): ";
+            cin >> choice;
+            continue;
+        }
+
+        game = generated ? newPooledGame(difficultyIndex(diff)) : createGame(diff, lvl);   // Dynamic Binding of game : Easy, Medium, Hard or Generated
+        if (game == nullptr)
         {
             cout << "Invalid difficulty.\n";
             continue;
@@ -420,4 +7722,3 @@ int main()
 
     cout << "Thank you for playing Sudoku! 🎉\n";
 }
-